@@ -0,0 +1,118 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include "macro.h"
+#include "glExtension.h"
+#include "traceRecorder.h"
+
+// Full-viewport geometry for kernel dispatch, uploaded once into a VBO.
+// A single triangle overshooting the viewport covers it without the diagonal
+// seam of a two-triangle quad, and v_texCoord = (v_position + 1) / 2 still
+// spans exactly [0, 1] across the visible part.
+// With OES_vertex_array_object the attribute setup is captured in a VAO, so a
+// dispatch is one bind and one draw. VAOs are not shared between contexts:
+// create one computeQuad per context.
+class computeQuad
+{
+public:
+	// vertex stage shared by every generated kernel
+	static const GLchar* vertexSource()
+	{
+		return R"(
+    attribute vec2 v_position;
+    varying vec2 v_texCoord;
+    void main(void)
+    {
+        v_texCoord = (v_position + vec2(1.0)) * 0.5;
+        gl_Position = vec4(v_position, 0.0, 1.0);
+    }
+    )";
+	}
+
+private:
+	GLuint vertexBuffer = 0;
+	GLuint vertexArray = 0;
+	PFNGLBINDVERTEXARRAYOESPROC bindVertexArray = nullptr;
+	PFNGLDELETEVERTEXARRAYSOESPROC deleteVertexArrays = nullptr;
+
+	inline void setAttribPointer() const
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer);
+		glEnableVertexAttribArray(POSITION_ATTRIB_LOCATION);
+		glVertexAttribPointer(POSITION_ATTRIB_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	}
+
+public:
+	computeQuad()
+	{
+		const GLfloat vertex_position[] = {
+			-1.0f, -1.0f,
+			3.0f, -1.0f,
+			-1.0f, 3.0f
+		};
+		glGenBuffers(1, &(this->vertexBuffer));
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_position), vertex_position, GL_STATIC_DRAW);
+
+		if (hasGLExtension("GL_OES_vertex_array_object")) {
+			auto genVertexArrays = loadProc<PFNGLGENVERTEXARRAYSOESPROC>("glGenVertexArraysOES");
+			this->bindVertexArray = loadProc<PFNGLBINDVERTEXARRAYOESPROC>("glBindVertexArrayOES");
+			this->deleteVertexArrays = loadProc<PFNGLDELETEVERTEXARRAYSOESPROC>("glDeleteVertexArraysOES");
+			if (genVertexArrays != nullptr && this->bindVertexArray != nullptr &&
+				this->deleteVertexArrays != nullptr) {
+				genVertexArrays(1, &(this->vertexArray));
+				this->bindVertexArray(this->vertexArray);
+				this->setAttribPointer();
+				this->bindVertexArray(0);
+			}
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	~computeQuad()
+	{
+		if (this->vertexArray != 0) {
+			EGL_CHECK(this->deleteVertexArrays(1, &(this->vertexArray)));
+		}
+		EGL_CHECK(glDeleteBuffers(1, &(this->vertexBuffer)));
+	}
+
+	computeQuad(const computeQuad&) = delete;
+	computeQuad& operator=(const computeQuad&) = delete;
+
+	inline bool hasVertexArray() const
+	{
+		return this->vertexArray != 0;
+	}
+
+	inline void bind() const
+	{
+		if (this->vertexArray != 0)
+			this->bindVertexArray(this->vertexArray);
+		else
+			this->setAttribPointer();
+	}
+
+	inline void unbind() const
+	{
+		if (this->vertexArray != 0)
+			this->bindVertexArray(0);
+		else
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// draws over the current viewport with the program in use
+	inline void draw() const
+	{
+		TRACE_SCOPE_NAMED(trace, "computeQuad::draw", "dispatch");
+		if (trace.isActive()) {
+			GLint viewport[4];
+			glGetIntegerv(GL_VIEWPORT, viewport);
+			trace.arg("width", viewport[2]).arg("height", viewport[3]);
+		}
+		this->bind();
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "macro.h"
+#include "gpgpuContext.h"
+
+// Hands every host thread its own EGL context in the root context's share
+// group, so uploads (textureManager), dispatches and readbacks can run on
+// different cores against the same textures, renderbuffers and programs.
+//
+// Framebuffer objects are container objects and are not shared: build the
+// fboManager on the thread that renders to / reads from it. A producer must
+// glFinish() (or fence) before another thread consumes what it wrote.
+class contextPool
+{
+	const GpgpuContext& root;
+	std::mutex mtx;
+	std::unordered_map<std::thread::id, std::unique_ptr<GpgpuContext>> workers;
+
+public:
+	explicit contextPool(const GpgpuContext& root)
+		: root{ root }
+	{
+	}
+
+	// worker contexts must go before the root context terminates the display
+	~contextPool()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->workers.clear();
+	}
+
+	contextPool(const contextPool&) = delete;
+	contextPool& operator=(const contextPool&) = delete;
+
+	// Makes the calling thread's context current, creating it on first use.
+	GpgpuContext& acquire()
+	{
+		const auto id = std::this_thread::get_id();
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			auto it = this->workers.find(id);
+			if (it != this->workers.end()) {
+				it->second->makeCurrent();
+				return *(it->second);
+			}
+		}
+		// context creation is slow, keep it outside the lock
+		auto context = GpgpuContext::createShared(this->root);
+		std::lock_guard<std::mutex> lock(this->mtx);
+		auto& slot = this->workers[id];
+		slot = std::move(context);
+		return *slot;
+	}
+
+	// Unbinds the calling thread's context but keeps it warm for the next acquire().
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		auto it = this->workers.find(std::this_thread::get_id());
+		if (it != this->workers.end())
+			it->second->releaseCurrent();
+	}
+
+	// Destroys the calling thread's context; call before the thread exits.
+	void retire()
+	{
+		std::unique_ptr<GpgpuContext> context;
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			auto it = this->workers.find(std::this_thread::get_id());
+			if (it == this->workers.end())
+				return;
+			context = std::move(it->second);
+			this->workers.erase(it);
+		}
+	}
+
+	inline size_t size()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		return this->workers.size();
+	}
+};
+
+// Binds the pool's context for the enclosing scope on the current thread.
+class scopedPoolContext
+{
+	contextPool& pool;
+
+public:
+	explicit scopedPoolContext(contextPool& pool)
+		: pool{ pool }
+	{
+		this->pool.acquire();
+	}
+
+	~scopedPoolContext()
+	{
+		this->pool.release();
+	}
+
+	scopedPoolContext(const scopedPoolContext&) = delete;
+	scopedPoolContext& operator=(const scopedPoolContext&) = delete;
+};
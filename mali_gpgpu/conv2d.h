@@ -0,0 +1,446 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "macro.h"
+#include "computeQuad.h"
+#include "elementwise.h"
+#include "fboManager.h"
+#include "gpuProfiler.h"
+#include "programRegistry.h"
+#include "shaderManager.h"
+#include "textureManager.h"
+#include "textureRef.h"
+#include "traceRecorder.h"
+
+struct conv2dShape
+{
+	GLsizei batch = 1;
+	GLsizei height = 0;
+	GLsizei width = 0;
+	GLsizei inChannels = 0;
+	GLsizei outChannels = 0;
+	GLsizei kernel = 3;   // square kernel size
+	GLsizei stride = 1;
+	GLsizei padding = 0;  // zero padding on every side
+
+	inline GLsizei outHeight() const { return (this->height + 2 * this->padding - this->kernel) / this->stride + 1; }
+	inline GLsizei outWidth() const { return (this->width + 2 * this->padding - this->kernel) / this->stride + 1; }
+	inline GLsizei inBlocks() const { return (this->inChannels + 3) / 4; }
+	inline GLsizei outBlocks() const { return (this->outChannels + 3) / 4; }
+};
+
+enum class conv2dAlgorithm
+{
+	direct,
+	winograd
+};
+
+// conv2d over NHWC tensors packed 4 channels per RGBA texel.
+//
+// A tensor is a (width * ceil(C/4)) x (batch * height) texture: texel
+// (x * C4 + c / 4, n * H + y) holds channels c..c+3 of pixel (n, y, x), i.e.
+// NHWC memory order when C is a multiple of 4 (see packNHWC()). The output
+// uses the same layout, one fragment per output pixel and 4-channel block.
+//
+// Weights come in OHWI order and are uploaded once at construction as a
+// (C4 * 4) x ((taps + 1) * OC4) texture: row tap * OC4 + oc4 holds the 4x4
+// block of every input block for that tap, the last OC4 rows the bias.
+//
+//  - direct: one pass, taps unrolled, the input-block loop has a constant
+//    bound. Generated per kernel size, stride, padding and channel blocks.
+//  - winograd F(2x2, 3x3), stride 1: the input transform (16 passes of
+//    2x2 fetches and adds), a batched 4x4-block product against the
+//    pre-transformed weights (2.25x fewer multiplies than direct), and the
+//    output transform (9 fetches and adds per pixel). The intermediates are
+//    stored scaled into [-1, 1]; on RGBA8 targets that makes the result
+//    roughly 20x less precise than direct, so winograd is opt-in.
+//
+// Values use the u2s()/s2u() encoding; result = alpha * conv + bias, so pick
+// alpha to keep results in [-1, 1].
+class conv2d
+{
+	programRegistry& registry;
+	const computeQuad& quad;
+	const conv2dShape shape;
+	const conv2dAlgorithm algorithm;
+
+	std::unique_ptr<textureManager> weights;
+	std::unique_ptr<fboManager> transformedInput; // winograd V
+	std::unique_ptr<fboManager> products;         // winograd M
+	std::unique_ptr<fboManager> output;
+
+	// Winograd F(2x2, 3x3) transforms
+	static constexpr float transformScaleV = 0.25f;   // |V| <= 4 |d|
+	static constexpr float transformScaleU = 1.0f / 2.25f; // |U| <= 2.25 |g|
+
+	inline GLsizei tilesWide() const { return (this->shape.outWidth() + 1) / 2; }
+	inline GLsizei tilesHigh() const { return (this->shape.outHeight() + 1) / 2; }
+	inline GLsizei taps() const
+	{
+		return this->algorithm == conv2dAlgorithm::winograd ? 16 : this->shape.kernel * this->shape.kernel;
+	}
+
+	static std::string glslInt(GLsizei value)
+	{
+		return std::to_string(value) + ".0";
+	}
+
+	// shared header: decoding helpers and a zero-padded NHWC fetch
+	std::string prelude() const
+	{
+		std::ostringstream os;
+		os << elementwise::glslPrelude();
+		os << R"(
+    #ifdef GL_FRAGMENT_PRECISION_HIGH
+    precision highp float;
+    #endif
+    uniform sampler2D input0;
+    uniform sampler2D weights;
+    uniform vec2 inputSize;
+    uniform vec2 weightSize;
+    uniform vec2 dims;
+    uniform float alpha;
+
+    vec4 fetch(float n, float y, float x, float c){
+        if (x < 0.0 || x >= dims.x || y < 0.0 || y >= dims.y)
+            return vec4(0.0);
+        return u2s(texture2D(input0, vec2((x * )" << glslInt(this->shape.inBlocks()) << R"( + c + 0.5) / inputSize.x,
+            (n * dims.y + y + 0.5) / inputSize.y)));
+    }
+
+    // the 4 output lanes of the weight block for (tap row, input block)
+    vec4 applyBlock(vec4 v, float row, float block){
+        float wy = (row + 0.5) / weightSize.y;
+        float wx = block * 4.0 + 0.5;
+        return vec4(dot(v, u2s(texture2D(weights, vec2(wx / weightSize.x, wy)))),
+            dot(v, u2s(texture2D(weights, vec2((wx + 1.0) / weightSize.x, wy)))),
+            dot(v, u2s(texture2D(weights, vec2((wx + 2.0) / weightSize.x, wy)))),
+            dot(v, u2s(texture2D(weights, vec2((wx + 3.0) / weightSize.x, wy)))));
+    }
+
+    vec4 bias(float block){
+        return u2s(texture2D(weights, vec2(0.5 / weightSize.x,
+            ()" << glslInt(this->taps() * this->shape.outBlocks()) << R"( + block + 0.5) / weightSize.y)));
+    }
+)";
+		return os.str();
+	}
+
+	std::string directSource() const
+	{
+		const conv2dShape& s = this->shape;
+		std::ostringstream os;
+		os << this->prelude();
+		os << "\n    void main(void){\n";
+		os << "        vec2 frag = floor(gl_FragCoord.xy);\n";
+		os << "        float ox = floor((frag.x + 0.5) / " << glslInt(s.outBlocks()) << ");\n";
+		os << "        float block = frag.x - ox * " << glslInt(s.outBlocks()) << ";\n";
+		os << "        float n = floor((frag.y + 0.5) / " << glslInt(s.outHeight()) << ");\n";
+		os << "        float oy = frag.y - n * " << glslInt(s.outHeight()) << ";\n";
+		os << "        float ix0 = ox * " << glslInt(s.stride) << " - " << glslInt(s.padding) << ";\n";
+		os << "        float iy0 = oy * " << glslInt(s.stride) << " - " << glslInt(s.padding) << ";\n";
+		os << "        vec4 acc = vec4(0.0);\n";
+		for (GLsizei ky = 0; ky < s.kernel; ++ky) {
+			for (GLsizei kx = 0; kx < s.kernel; ++kx) {
+				os << "        for (int c = 0; c < " << s.inBlocks() << "; ++c) {\n";
+				os << "            acc += applyBlock(fetch(n, iy0 + " << glslInt(ky) << ", ix0 + " << glslInt(kx)
+					<< ", float(c)), " << glslInt((ky * s.kernel + kx) * s.outBlocks()) << " + block, float(c));\n";
+				os << "        }\n";
+			}
+		}
+		os << "        gl_FragColor = s2u(alpha * acc + bias(block));\n    }\n";
+		return os.str();
+	}
+
+	// V[i][j] = sum BT[i][a] d[a][b] BT[j][b]; every BT row has two +-1 entries
+	std::string inputTransformSource(int i, int j) const
+	{
+		static const int rows[4][2][2] = {
+			{ { 0, 1 }, { 2, -1 } },
+			{ { 1, 1 }, { 2, 1 } },
+			{ { 1, -1 }, { 2, 1 } },
+			{ { 1, 1 }, { 3, -1 } }
+		};
+		const conv2dShape& s = this->shape;
+		const GLsizei stripe = s.batch * this->tilesHigh();
+		std::ostringstream os;
+		os << this->prelude();
+		os << "\n    void main(void){\n";
+		os << "        vec2 frag = floor(gl_FragCoord.xy);\n";
+		os << "        float tx = floor((frag.x + 0.5) / " << glslInt(s.inBlocks()) << ");\n";
+		os << "        float c = frag.x - tx * " << glslInt(s.inBlocks()) << ";\n";
+		os << "        float r = frag.y - " << glslInt((i * 4 + j) * stripe) << ";\n";
+		os << "        float n = floor((r + 0.5) / " << glslInt(this->tilesHigh()) << ");\n";
+		os << "        float ty = r - n * " << glslInt(this->tilesHigh()) << ";\n";
+		os << "        float x0 = tx * 2.0 - " << glslInt(s.padding) << ";\n";
+		os << "        float y0 = ty * 2.0 - " << glslInt(s.padding) << ";\n";
+		os << "        vec4 v = vec4(0.0);\n";
+		for (const auto& a : rows[i]) {
+			for (const auto& b : rows[j]) {
+				os << "        v " << (a[1] * b[1] > 0 ? "+" : "-") << "= fetch(n, y0 + " << glslInt(a[0])
+					<< ", x0 + " << glslInt(b[0]) << ", c);\n";
+			}
+		}
+		os << "        gl_FragColor = s2u(v * " << elementwise::glslFloat(transformScaleV) << ");\n    }\n";
+		return os.str();
+	}
+
+	// M[xi] = sum over input blocks of U[xi] * V[xi], per tile and output block
+	std::string productSource() const
+	{
+		const conv2dShape& s = this->shape;
+		const GLsizei stripe = s.batch * this->tilesHigh();
+		std::ostringstream os;
+		os << this->prelude();
+		os << "\n    void main(void){\n";
+		os << "        vec2 frag = floor(gl_FragCoord.xy);\n";
+		os << "        float tx = floor((frag.x + 0.5) / " << glslInt(s.outBlocks()) << ");\n";
+		os << "        float block = frag.x - tx * " << glslInt(s.outBlocks()) << ";\n";
+		os << "        float xi = floor((frag.y + 0.5) / " << glslInt(stripe) << ");\n";
+		os << "        float vy = (frag.y + 0.5) / inputSize.y;\n";
+		os << "        vec4 acc = vec4(0.0);\n";
+		os << "        for (int c = 0; c < " << s.inBlocks() << "; ++c) {\n";
+		os << "            vec4 v = u2s(texture2D(input0, vec2((tx * " << glslInt(s.inBlocks())
+			<< " + float(c) + 0.5) / inputSize.x, vy)));\n";
+		os << "            acc += applyBlock(v, xi * " << glslInt(s.outBlocks()) << " + block, float(c));\n";
+		os << "        }\n";
+		os << "        gl_FragColor = s2u(alpha * acc);\n    }\n";
+		return os.str();
+	}
+
+	// Y = AT M A; output pixel (r, c) of its tile sums M[r..r+2][c..c+2]
+	// with signs (1, 1, 1) for index 0 and (1, -1, -1) for index 1.
+	std::string outputTransformSource() const
+	{
+		const conv2dShape& s = this->shape;
+		const GLsizei stripe = s.batch * this->tilesHigh();
+		std::ostringstream os;
+		os << this->prelude();
+		os << "\n    uniform float outScale;\n";
+		os << "\n    void main(void){\n";
+		os << "        vec2 frag = floor(gl_FragCoord.xy);\n";
+		os << "        float ox = floor((frag.x + 0.5) / " << glslInt(s.outBlocks()) << ");\n";
+		os << "        float block = frag.x - ox * " << glslInt(s.outBlocks()) << ";\n";
+		os << "        float n = floor((frag.y + 0.5) / " << glslInt(s.outHeight()) << ");\n";
+		os << "        float oy = frag.y - n * " << glslInt(s.outHeight()) << ";\n";
+		os << "        float tx = floor(ox * 0.5);\n";
+		os << "        float ty = floor(oy * 0.5);\n";
+		os << "        float pc = ox - tx * 2.0;\n";
+		os << "        float pr = oy - ty * 2.0;\n";
+		os << "        float signC = 1.0 - 2.0 * pc;\n";
+		os << "        float signR = 1.0 - 2.0 * pr;\n";
+		os << "        float mx = (tx * " << glslInt(s.outBlocks()) << " + block + 0.5) / inputSize.x;\n";
+		os << "        float tileRow = n * " << glslInt(this->tilesHigh()) << " + ty + 0.5;\n";
+		os << "        vec4 y = vec4(0.0);\n";
+		for (int da = 0; da < 3; ++da) {
+			for (int db = 0; db < 3; ++db) {
+				os << "        y += " << (da ? "signR * " : "") << (db ? "signC * " : "")
+					<< "u2s(texture2D(input0, vec2(mx, (((pr + " << glslInt(da) << ") * 4.0 + pc + "
+					<< glslInt(db) << ") * " << glslInt(stripe) << " + tileRow) / inputSize.y)));\n";
+			}
+		}
+		os << "        gl_FragColor = s2u(outScale * y + bias(block));\n    }\n";
+		return os.str();
+	}
+
+	std::vector<GLubyte> packWeights(const float* ohwi, const float* bias) const
+	{
+		const conv2dShape& s = this->shape;
+		const GLsizei width = s.inBlocks() * 4;
+		const GLsizei taps = this->taps();
+		std::vector<GLubyte> pixels(static_cast<size_t>(width) * (taps + 1) * s.outBlocks() * 4,
+			elementwise::encodeSigned(0.0f));
+		auto at = [&](GLsizei tap, GLsizei oc, GLsizei ic) -> GLubyte& {
+			const size_t row = static_cast<size_t>(tap) * s.outBlocks() + oc / 4;
+			const size_t texel = static_cast<size_t>(ic / 4) * 4 + oc % 4;
+			return pixels[(row * width + texel) * 4 + ic % 4];
+		};
+		const GLsizei k = s.kernel;
+		for (GLsizei oc = 0; oc < s.outChannels; ++oc) {
+			for (GLsizei ic = 0; ic < s.inChannels; ++ic) {
+				auto g = [&](GLsizei ky, GLsizei kx) {
+					return ohwi[((static_cast<size_t>(oc) * k + ky) * k + kx) * s.inChannels + ic];
+				};
+				if (this->algorithm != conv2dAlgorithm::winograd) {
+					for (GLsizei ky = 0; ky < k; ++ky)
+						for (GLsizei kx = 0; kx < k; ++kx)
+							at(ky * k + kx, oc, ic) = elementwise::encodeSigned(g(ky, kx));
+					continue;
+				}
+				// U = G g GT
+				static const float G[4][3] = {
+					{ 1.0f, 0.0f, 0.0f },
+					{ 0.5f, 0.5f, 0.5f },
+					{ 0.5f, -0.5f, 0.5f },
+					{ 0.0f, 0.0f, 1.0f }
+				};
+				float gg[4][3];
+				for (int i = 0; i < 4; ++i)
+					for (int x = 0; x < 3; ++x)
+						gg[i][x] = G[i][0] * g(0, x) + G[i][1] * g(1, x) + G[i][2] * g(2, x);
+				for (int i = 0; i < 4; ++i)
+					for (int j = 0; j < 4; ++j)
+						at(i * 4 + j, oc, ic) = elementwise::encodeSigned(transformScaleU *
+							(gg[i][0] * G[j][0] + gg[i][1] * G[j][1] + gg[i][2] * G[j][2]));
+			}
+			if (bias != nullptr) {
+				const size_t row = static_cast<size_t>(taps) * s.outBlocks() + oc / 4;
+				pixels[row * width * 4 + oc % 4] = elementwise::encodeSigned(bias[oc]);
+			}
+		}
+		return pixels;
+	}
+
+	void setCommonUniforms(shaderManager& program, const textureRef& input, float alpha) const
+	{
+		program.useProgram();
+		input.bindAsInput(GL_TEXTURE0, program.uniformLocation("input0"));
+		this->weights->bindAsInput(GL_TEXTURE1, program.uniformLocation("weights"));
+		glUniform2f(program.uniformLocation("inputSize"),
+			static_cast<GLfloat>(input.width), static_cast<GLfloat>(input.height));
+		const textureRef w = this->weights->ref();
+		glUniform2f(program.uniformLocation("weightSize"),
+			static_cast<GLfloat>(w.width), static_cast<GLfloat>(w.height));
+		glUniform2f(program.uniformLocation("dims"),
+			static_cast<GLfloat>(this->shape.width), static_cast<GLfloat>(this->shape.height));
+		glUniform1f(program.uniformLocation("alpha"), alpha);
+	}
+
+	std::shared_ptr<shaderManager> program(const std::string& fragmentSource) const
+	{
+		return this->registry.get(computeQuad::vertexSource(), fragmentSource.c_str());
+	}
+
+	void draw(const fboManager& target, GLint y, GLsizei height, const char* name) const
+	{
+		target.bindFBO();
+		glViewport(0, y, target.width(), height);
+		GPU_PROFILE_SCOPE(name, gpuOpKind::dispatch);
+		this->quad.draw();
+	}
+
+public:
+	// weights: OHWI, outChannels x kernel x kernel x inChannels.
+	// bias: outChannels values, or nullptr for none.
+	conv2d(programRegistry& registry, const computeQuad& quad, const conv2dShape& shape,
+		const float* weights, const float* bias = nullptr,
+		conv2dAlgorithm algorithm = conv2dAlgorithm::direct)
+		: registry{ registry }, quad{ quad }, shape{ shape }, algorithm{ algorithm }
+	{
+		if (shape.kernel < 1 || shape.stride < 1 || shape.padding < 0 ||
+			shape.outHeight() < 1 || shape.outWidth() < 1 || shape.inChannels < 1 || shape.outChannels < 1) {
+			fprintf(stderr, "conv2d: invalid shape\n");
+			exit(-1);
+		}
+		if (this->algorithm == conv2dAlgorithm::winograd && (shape.kernel != 3 || shape.stride != 1)) {
+			fprintf(stderr, "conv2d: winograd needs a 3x3 kernel with stride 1\n");
+			exit(-1);
+		}
+
+		const auto pixels = this->packWeights(weights, bias);
+		this->weights.reset(new textureManager(shape.inBlocks() * 4,
+			(this->taps() + 1) * shape.outBlocks(), pixels.data(), GL_TEXTURE0, -1));
+
+		this->output.reset(new fboManager(shape.outWidth() * shape.outBlocks(),
+			shape.batch * shape.outHeight(), fboAttachment::texture));
+		if (this->algorithm == conv2dAlgorithm::winograd) {
+			const GLsizei stripes = 16 * shape.batch * this->tilesHigh();
+			this->transformedInput.reset(new fboManager(this->tilesWide() * shape.inBlocks(),
+				stripes, fboAttachment::texture));
+			this->products.reset(new fboManager(this->tilesWide() * shape.outBlocks(),
+				stripes, fboAttachment::texture));
+		}
+	}
+
+	conv2d(const conv2d&) = delete;
+	conv2d& operator=(const conv2d&) = delete;
+
+	inline conv2dAlgorithm getAlgorithm() const
+	{
+		return this->algorithm;
+	}
+
+	inline const conv2dShape& getShape() const
+	{
+		return this->shape;
+	}
+
+	// input: packNHWC() layout of shape. The result stays on the GPU.
+	const fboManager& run(const textureRef& input, float alpha = 1.0f)
+	{
+		const conv2dShape& s = this->shape;
+		if (input.width != s.width * s.inBlocks() || input.height != s.batch * s.height) {
+			fprintf(stderr, "conv2d: input is %dx%d, expected %dx%d\n", input.width, input.height,
+				s.width * s.inBlocks(), s.batch * s.height);
+			exit(-1);
+		}
+		TRACE_SCOPE_NAMED(trace, "conv2d::run", "dispatch");
+		trace.arg("kernel", s.kernel).arg("stride", s.stride)
+			.arg("winograd", this->algorithm == conv2dAlgorithm::winograd);
+
+		if (this->algorithm == conv2dAlgorithm::direct) {
+			const auto direct = this->program(this->directSource());
+			this->setCommonUniforms(*direct, input, alpha);
+			this->draw(*(this->output), 0, this->output->height(), "conv2d::direct");
+			return *(this->output);
+		}
+
+		// one stripe of V per transform element, each with its own shader
+		const GLsizei stripe = s.batch * this->tilesHigh();
+		for (int i = 0; i < 4; ++i) {
+			for (int j = 0; j < 4; ++j) {
+				const auto transform = this->program(this->inputTransformSource(i, j));
+				this->setCommonUniforms(*transform, input, alpha);
+				this->draw(*(this->transformedInput), (i * 4 + j) * stripe, stripe, "conv2d::winogradInput");
+			}
+		}
+
+		// M keeps alpha * 9/4 * sum(Us Vs) = alpha * M / 4: headroom for the 9-term output sum
+		const float productScale = alpha / (transformScaleU * transformScaleV) / 4.0f;
+		const auto product = this->program(this->productSource());
+		this->setCommonUniforms(*product, this->transformedInput->ref(), productScale);
+		this->draw(*(this->products), 0, this->products->height(), "conv2d::winogradProduct");
+
+		const auto transform = this->program(this->outputTransformSource());
+		this->setCommonUniforms(*transform, this->products->ref(), alpha);
+		glUniform1f(transform->uniformLocation("outScale"), 4.0f);
+		this->draw(*(this->output), 0, this->output->height(), "conv2d::winogradOutput");
+		return *(this->output);
+	}
+
+	// NHWC floats as a (width * ceil(C/4)) x (batch * height) RGBA8 texture.
+	static std::vector<GLubyte> packNHWC(const float* data, GLsizei batch, GLsizei height,
+		GLsizei width, GLsizei channels)
+	{
+		const GLsizei blocks = (channels + 3) / 4;
+		std::vector<GLubyte> pixels(static_cast<size_t>(batch) * height * width * blocks * 4,
+			elementwise::encodeSigned(0.0f));
+		const size_t pixelCount = static_cast<size_t>(batch) * height * width;
+		for (size_t p = 0; p < pixelCount; ++p)
+			for (GLsizei c = 0; c < channels; ++c)
+				pixels[p * blocks * 4 + c] = elementwise::encodeSigned(data[p * channels + c]);
+		return pixels;
+	}
+
+	// Inverse of packNHWC() for a readback.
+	static std::vector<float> unpackNHWC(const GLubyte* pixels, GLsizei batch, GLsizei height,
+		GLsizei width, GLsizei channels)
+	{
+		const GLsizei blocks = (channels + 3) / 4;
+		const size_t pixelCount = static_cast<size_t>(batch) * height * width;
+		std::vector<float> data(pixelCount * channels);
+		for (size_t p = 0; p < pixelCount; ++p)
+			for (GLsizei c = 0; c < channels; ++c)
+				data[p * channels + c] = elementwise::decodeSigned(pixels[p * blocks * 4 + c]);
+		return data;
+	}
+};
@@ -0,0 +1,262 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "macro.h"
+#include "glExtension.h"
+#ifdef _WIN32
+#include "window.h"
+#endif
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// how the context was made current, in order of preference
+enum class eglSurfaceKind
+{
+	surfaceless, // EGL_KHR_surfaceless_context + GL_OES_surfaceless_context
+	pbuffer,     // 1x1 pbuffer, for drivers without surfaceless support
+	window       // dummy native window, last resort (Win32 only)
+};
+
+inline const char* toString(eglSurfaceKind kind)
+{
+	switch (kind) {
+	case eglSurfaceKind::surfaceless: return "surfaceless";
+	case eglSurfaceKind::pbuffer: return "pbuffer";
+	case eglSurfaceKind::window: return "window";
+	}
+	return "unknown";
+}
+
+struct eglContextBundle
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLConfig config = nullptr;
+	EGLContext context = EGL_NO_CONTEXT;
+	EGLSurface surface = EGL_NO_SURFACE;
+	eglSurfaceKind kind = eglSurfaceKind::surfaceless;
+#ifdef _WIN32
+	HWND window = NULL;
+#endif
+};
+
+namespace eglContextFactory
+{
+	/* EGL Configuration, EGL_SURFACE_TYPE is filled in per attempt */
+	inline EGLConfig chooseConfig(EGLDisplay display, EGLint surfaceType)
+	{
+		const EGLint attributes[] =
+		{
+			EGL_RED_SIZE, 8,
+			EGL_GREEN_SIZE, 8,
+			EGL_BLUE_SIZE, 8,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+			EGL_SURFACE_TYPE, surfaceType,
+			EGL_NONE
+		};
+		EGLConfig config = nullptr;
+		EGLint numConfigs = 0;
+		if (!eglChooseConfig(display, attributes, &config, 1, &numConfigs) || numConfigs == 0) {
+			eglGetError();
+			return nullptr;
+		}
+		return config;
+	}
+
+	inline EGLContext createContext(EGLDisplay display, EGLConfig config,
+		EGLContext shareContext = EGL_NO_CONTEXT)
+	{
+		const EGLint contextAttributes[] =
+		{
+			EGL_CONTEXT_CLIENT_VERSION, 2,
+			EGL_NONE
+		};
+		EGLContext context = eglCreateContext(display, config, shareContext, contextAttributes);
+		if (context == EGL_NO_CONTEXT)
+			eglGetError();
+		return context;
+	}
+
+	// Prefer the Mesa surfaceless platform so CI does not need a display server,
+	// then fall back to the default display (fbdev on Mali, desktop on Win32).
+	inline EGLDisplay openDisplay()
+	{
+		if (hasEGLExtension(EGL_NO_DISPLAY, "EGL_EXT_platform_base") &&
+			hasEGLExtension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+			auto getPlatformDisplay = loadProc<PFNEGLGETPLATFORMDISPLAYEXTPROC>("eglGetPlatformDisplayEXT");
+			if (getPlatformDisplay != nullptr) {
+				EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+				if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL))
+					return display;
+				eglGetError();
+			}
+		}
+
+		EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL))
+			return display;
+		eglGetError();
+		return EGL_NO_DISPLAY;
+	}
+
+	inline bool trySurfaceless(eglContextBundle& bundle, EGLContext shareContext)
+	{
+		if (!hasEGLExtension(bundle.display, "EGL_KHR_surfaceless_context"))
+			return false;
+		EGLConfig config = chooseConfig(bundle.display, EGL_DONT_CARE);
+		if (config == nullptr)
+			return false;
+		EGLContext context = createContext(bundle.display, config, shareContext);
+		if (context == EGL_NO_CONTEXT)
+			return false;
+		if (eglMakeCurrent(bundle.display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+			// GLES additionally has to allow a context without default framebuffer
+			if (hasGLExtension("GL_OES_surfaceless_context")) {
+				bundle.config = config;
+				bundle.context = context;
+				bundle.surface = EGL_NO_SURFACE;
+				bundle.kind = eglSurfaceKind::surfaceless;
+				return true;
+			}
+			eglMakeCurrent(bundle.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		}
+		eglGetError();
+		eglDestroyContext(bundle.display, context);
+		return false;
+	}
+
+	inline bool tryPbuffer(eglContextBundle& bundle, EGLContext shareContext)
+	{
+		const EGLint pbufferAttributes[] =
+		{
+			EGL_WIDTH, 1,
+			EGL_HEIGHT, 1,
+			EGL_NONE
+		};
+		EGLConfig config = chooseConfig(bundle.display, EGL_PBUFFER_BIT);
+		if (config == nullptr)
+			return false;
+		EGLSurface surface = eglCreatePbufferSurface(bundle.display, config, pbufferAttributes);
+		if (surface == EGL_NO_SURFACE) {
+			eglGetError();
+			return false;
+		}
+		EGLContext context = createContext(bundle.display, config, shareContext);
+		if (context != EGL_NO_CONTEXT) {
+			if (eglMakeCurrent(bundle.display, surface, surface, context)) {
+				bundle.config = config;
+				bundle.context = context;
+				bundle.surface = surface;
+				bundle.kind = eglSurfaceKind::pbuffer;
+				return true;
+			}
+			eglGetError();
+			eglDestroyContext(bundle.display, context);
+		}
+		eglDestroySurface(bundle.display, surface);
+		return false;
+	}
+
+	inline bool tryWindow(eglContextBundle& bundle, EGLContext shareContext)
+	{
+#ifdef _WIN32
+		EGLConfig config = chooseConfig(bundle.display, EGL_WINDOW_BIT);
+		if (config == nullptr)
+			return false;
+		HWND window = create_window(DUMMY_WINDOW_SIZE_WIDTH, DUMMY_WINDOW_SIZE_HEIGHT);
+		EGLSurface surface = eglCreateWindowSurface(bundle.display,
+			config, (EGLNativeWindowType)window, NULL);
+		if (surface == EGL_NO_SURFACE) {
+			eglGetError();
+			DestroyWindow(window);
+			return false;
+		}
+		EGLContext context = createContext(bundle.display, config, shareContext);
+		if (context != EGL_NO_CONTEXT) {
+			if (eglMakeCurrent(bundle.display, surface, surface, context)) {
+				bundle.config = config;
+				bundle.context = context;
+				bundle.surface = surface;
+				bundle.kind = eglSurfaceKind::window;
+				bundle.window = window;
+				return true;
+			}
+			eglGetError();
+			eglDestroyContext(bundle.display, context);
+		}
+		eglDestroySurface(bundle.display, surface);
+		DestroyWindow(window);
+#else
+		(void)bundle;
+		(void)shareContext;
+#endif
+		return false;
+	}
+
+	// Creates a context and makes it current: surfaceless -> pbuffer -> window.
+	inline eglContextBundle create()
+	{
+		eglContextBundle bundle;
+		bundle.display = openDisplay();
+		if (bundle.display == EGL_NO_DISPLAY)
+		{
+			printf("Failed to initialize EGL display.\n");
+			exit(-1);
+		}
+		eglBindAPI(EGL_OPENGL_ES_API);
+
+		if (trySurfaceless(bundle, EGL_NO_CONTEXT) ||
+			tryPbuffer(bundle, EGL_NO_CONTEXT) ||
+			tryWindow(bundle, EGL_NO_CONTEXT))
+			return bundle;
+
+		printf("Failed to create EGL context.\n");
+		eglTerminate(bundle.display);
+		exit(-1);
+	}
+
+	// Creates a context sharing textures, buffers, renderbuffers and programs with
+	// root on root's display and makes it current on the calling thread.
+	inline eglContextBundle createShared(const eglContextBundle& root)
+	{
+		eglContextBundle bundle;
+		bundle.display = root.display;
+		eglBindAPI(EGL_OPENGL_ES_API);
+
+		if (trySurfaceless(bundle, root.context) ||
+			tryPbuffer(bundle, root.context))
+			return bundle;
+
+		printf("Failed to create shared EGL context.\n");
+		exit(-1);
+	}
+
+	// terminateDisplay must be false for contexts from createShared()
+	inline void destroy(eglContextBundle& bundle, bool terminateDisplay = true)
+	{
+		// only unbind when current here, so tearing down a worker's context
+		// from another thread leaves that thread's binding alone
+		if (eglGetCurrentContext() == bundle.context) {
+			EGL_CHECK(eglMakeCurrent(bundle.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT));
+		}
+		if (bundle.surface != EGL_NO_SURFACE) {
+			EGL_CHECK(eglDestroySurface(bundle.display, bundle.surface));
+		}
+		EGL_CHECK(eglDestroyContext(bundle.display, bundle.context));
+		if (terminateDisplay) {
+			EGL_CHECK(eglTerminate(bundle.display));
+		}
+#ifdef _WIN32
+		if (bundle.window != NULL)
+			DestroyWindow(bundle.window);
+#endif
+		bundle = eglContextBundle{};
+	}
+}
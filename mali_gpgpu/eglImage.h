@@ -0,0 +1,141 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include "macro.h"
+#include "glExtension.h"
+#include "textureFormat.h"
+
+// DRM fourcc codes (drm_fourcc.h), named for the little-endian packed
+// pixel, so ABGR8888 is R, G, B, A bytes in memory.
+inline constexpr uint32_t drmFourcc(char a, char b, char c, char d)
+{
+	return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) |
+		(static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+namespace drmFormat
+{
+	constexpr uint32_t ABGR8888 = drmFourcc('A', 'B', '2', '4');
+	constexpr uint32_t XBGR8888 = drmFourcc('X', 'B', '2', '4');
+	constexpr uint32_t R8 = drmFourcc('R', '8', ' ', ' ');
+	constexpr uint32_t GR88 = drmFourcc('G', 'R', '8', '8');
+
+	// texture format sampling this layout, nullptr if unsupported;
+	// XBGR8888 samples as rgba8 with an undefined alpha
+	inline const textureFormat* toTextureFormat(uint32_t fourcc)
+	{
+		switch (fourcc) {
+		case ABGR8888:
+		case XBGR8888: return &textureFormat::rgba8();
+		case R8: return &textureFormat::r8();
+		case GR88: return &textureFormat::rg8();
+		default: return nullptr;
+		}
+	}
+}
+
+// Single-plane dma-buf as handed out by a camera, decoder or udmabuf.
+// pitch, offset and size are in bytes; size 0 asks the fd (lseek to end).
+struct dmaBufDesc
+{
+	int fd;
+	GLsizei width;
+	GLsizei height;
+	GLsizei pitch;
+	GLsizei offset;
+	uint32_t fourcc;
+	size_t size = 0;
+};
+
+// Owns an EGLImageKHR and attaches it to textures, so the GPU samples the
+// buffer's own memory instead of a glTexImage2D copy. Needs
+// EGL_KHR_image_base plus GL_OES_EGL_image; dma-bufs also need
+// EGL_EXT_image_dma_buf_import (see canImportDmaBuf()).
+class eglImage
+{
+	struct imageProcs
+	{
+		PFNEGLCREATEIMAGEKHRPROC create = nullptr;
+		PFNEGLDESTROYIMAGEKHRPROC destroy = nullptr;
+		PFNGLEGLIMAGETARGETTEXTURE2DOESPROC targetTexture = nullptr;
+	};
+
+	static const imageProcs& procs()
+	{
+		static const imageProcs procs = [] {
+			imageProcs p;
+			p.create = loadProc<PFNEGLCREATEIMAGEKHRPROC>("eglCreateImageKHR");
+			p.destroy = loadProc<PFNEGLDESTROYIMAGEKHRPROC>("eglDestroyImageKHR");
+			p.targetTexture = loadProc<PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>("glEGLImageTargetTexture2DOES");
+			return p;
+		}();
+		return procs;
+	}
+
+	EGLDisplay display;
+	EGLImageKHR image;
+
+	eglImage(EGLDisplay display, EGLImageKHR image)
+		: display{ display }, image{ image }
+	{
+	}
+
+public:
+	~eglImage()
+	{
+		EGL_CHECK(procs().destroy(this->display, this->image));
+	}
+
+	eglImage(const eglImage&) = delete;
+	eglImage& operator=(const eglImage&) = delete;
+
+	// requires a current context
+	static bool isSupported(EGLDisplay display)
+	{
+		return hasEGLExtension(display, "EGL_KHR_image_base") && hasGLExtension("GL_OES_EGL_image") &&
+			procs().create != nullptr && procs().destroy != nullptr && procs().targetTexture != nullptr;
+	}
+
+	static bool canImportDmaBuf(EGLDisplay display)
+	{
+		return isSupported(display) && hasEGLExtension(display, "EGL_EXT_image_dma_buf_import");
+	}
+
+	// nullptr when the driver rejects the buffer (format, pitch, tiling...)
+	static std::unique_ptr<eglImage> fromDmaBuf(EGLDisplay display, const dmaBufDesc& buffer)
+	{
+		if (!canImportDmaBuf(display))
+			return nullptr;
+		const EGLint attribs[] = {
+			EGL_WIDTH, buffer.width,
+			EGL_HEIGHT, buffer.height,
+			EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(buffer.fourcc),
+			EGL_DMA_BUF_PLANE0_FD_EXT, buffer.fd,
+			EGL_DMA_BUF_PLANE0_OFFSET_EXT, buffer.offset,
+			EGL_DMA_BUF_PLANE0_PITCH_EXT, buffer.pitch,
+			EGL_NONE
+		};
+		// no client buffer: the attributes name the memory
+		EGLImageKHR image = procs().create(display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+		if (image == EGL_NO_IMAGE_KHR) {
+			fprintf(stderr, "eglImage: dma-buf import failed (0x%x)\n", eglGetError());
+			return nullptr;
+		}
+		return std::unique_ptr<eglImage>(new eglImage(display, image));
+	}
+
+	// Makes the texture bound to target an alias of the image.
+	inline void bindTexture(GLenum target) const
+	{
+		procs().targetTexture(target, static_cast<GLeglImageOES>(this->image));
+	}
+
+	inline EGLImageKHR handle() const { return this->image; }
+};
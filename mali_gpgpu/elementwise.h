@@ -0,0 +1,356 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "macro.h"
+#include "computeQuad.h"
+#include "fboManager.h"
+#include "floatPacking.h"
+#include "gpuProfiler.h"
+#include "programRegistry.h"
+#include "shaderManager.h"
+#include "textureRef.h"
+
+// Elementwise kernels written as C++ expressions:
+//
+//   using namespace elementwise;
+//   input<0> a; input<1> b; input<2> c; input<3> d;
+//   auto kernel = compile(registry, (sigmoid(a) * c + sigmoid(b) * d) / 2.0f);
+//   kernel.run(quad, fbo, { texA->ref(), texB->ref(), texC->ref(), texD->ref() });
+//
+// The expression is lazy: it only generates the fragment shader, with one
+// sampler per input<N>. Samples are decoded with u2s() to [-1, 1] and the
+// result encoded with s2u(), the same convention as the hand-written kernel,
+// so keep results in [-1, 1]. Programs are cached in the programRegistry by
+// their generated source, i.e. per expression shape (and constant values).
+// With encoding::packedFloat every texel is instead one full float32 (see
+// floatPacking.h), broadcast to all four lanes of x<N>; the result is .x.
+// encoding::raw samples and writes values unchanged, for float formats.
+// (With raw, mediump may still be fp16 inside the shader.)
+namespace elementwise
+{
+	enum class encoding
+	{
+		signedUnorm, // 4 values per texel, u2s()/s2u()
+		packedFloat, // 1 float32 per texel, unpackFloat()/packFloat()
+		raw          // 4 values per texel as stored, for float textureFormats
+	};
+
+	// decoding/encoding and math helpers available to every generated kernel
+	inline const char* glslPrelude()
+	{
+		return R"(
+    #define SIGMOID_COEF 6.0
+    precision mediump float;
+    varying vec2 v_texCoord;
+
+    vec4 u2s(vec4 uvec){
+        // convert normalized unsigned value [0, 1] into signed value [-1.0, 1.0]
+        bvec4 isMinus = greaterThan(uvec, vec4(0.5));
+        vec4 signed = (uvec - vec4(isMinus));
+        return signed * 2.0; // normalized value
+    }
+
+    vec4 s2u(vec4 svec){
+        // convert [-1.0, 1.0] signed value into unsigned value [0, 1]
+        bvec4 isMinus = lessThan(svec, vec4(0.0));
+        vec4 uns = (svec / 2.0 + vec4(isMinus));
+        return uns; // [0.0, 1.0]
+    }
+
+    vec4 sigmoid(vec4 v){
+        return 1.0 / (1.0 + exp( -SIGMOID_COEF * v));
+    }
+
+    vec4 relu(vec4 v){
+        return max(v, vec4(0.0));
+    }
+
+    vec4 tanh4(vec4 v){
+        vec4 e = exp(-2.0 * abs(v));
+        return sign(v) * (1.0 - e) / (1.0 + e);
+    }
+)";
+	}
+
+	// GLSL ES needs a decimal point or exponent in float literals
+	inline std::string glslFloat(float value)
+	{
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.9g", value);
+		std::string literal(buffer);
+		if (literal.find_first_of(".e") == std::string::npos)
+			literal += ".0";
+		return literal;
+	}
+
+	// host-side s2u()/u2s() for RGBA8 channels
+	inline GLubyte encodeSigned(float value)
+	{
+		float u = value / 2.0f + (value < 0.0f ? 1.0f : 0.0f);
+		u = u < 0.0f ? 0.0f : (u > 1.0f ? 1.0f : u);
+		return static_cast<GLubyte>(u * 255.0f + 0.5f);
+	}
+
+	inline float decodeSigned(GLubyte value)
+	{
+		const float u = value / 255.0f;
+		return (u > 0.5f ? u - 1.0f : u) * 2.0f;
+	}
+
+	template <class E>
+	struct isExpr : std::false_type {};
+
+	template <int N>
+	struct input
+	{
+		static_assert(N >= 0 && N < TEXTURE_UNIT_NUM, "input index out of range");
+		static constexpr int arity = N + 1;
+		void emit(std::ostream& os) const { os << "x" << N; }
+	};
+	template <int N>
+	struct isExpr<input<N>> : std::true_type {};
+
+	struct constant
+	{
+		float value;
+		static constexpr int arity = 0;
+		void emit(std::ostream& os) const { os << "vec4(" << glslFloat(this->value) << ")"; }
+	};
+	template <>
+	struct isExpr<constant> : std::true_type {};
+
+	template <class Op, class E>
+	struct unaryExpr
+	{
+		E operand;
+		static constexpr int arity = E::arity;
+		void emit(std::ostream& os) const
+		{
+			os << Op::name() << "(";
+			this->operand.emit(os);
+			os << ")";
+		}
+	};
+	template <class Op, class E>
+	struct isExpr<unaryExpr<Op, E>> : std::true_type {};
+
+	template <class Op, class L, class R>
+	struct binaryExpr
+	{
+		L lhs;
+		R rhs;
+		static constexpr int arity = L::arity > R::arity ? L::arity : R::arity;
+		void emit(std::ostream& os) const
+		{
+			Op::emit(os, this->lhs, this->rhs);
+		}
+	};
+	template <class Op, class L, class R>
+	struct isExpr<binaryExpr<Op, L, R>> : std::true_type {};
+
+	namespace op
+	{
+		struct neg { static const char* name() { return "-"; } };
+		struct sigmoid { static const char* name() { return "sigmoid"; } };
+		struct exp { static const char* name() { return "exp"; } };
+		struct abs { static const char* name() { return "abs"; } };
+		struct relu { static const char* name() { return "relu"; } };
+		struct tanh { static const char* name() { return "tanh4"; } };
+		struct sqrt { static const char* name() { return "sqrt"; } };
+
+		template <char Symbol>
+		struct infix
+		{
+			template <class L, class R>
+			static void emit(std::ostream& os, const L& lhs, const R& rhs)
+			{
+				os << "(";
+				lhs.emit(os);
+				os << " " << Symbol << " ";
+				rhs.emit(os);
+				os << ")";
+			}
+		};
+		using add = infix<'+'>;
+		using sub = infix<'-'>;
+		using mul = infix<'*'>;
+		using div = infix<'/'>;
+
+		struct callMin
+		{
+			template <class L, class R>
+			static void emit(std::ostream& os, const L& lhs, const R& rhs)
+			{
+				os << "min(";
+				lhs.emit(os);
+				os << ", ";
+				rhs.emit(os);
+				os << ")";
+			}
+		};
+
+		struct callMax
+		{
+			template <class L, class R>
+			static void emit(std::ostream& os, const L& lhs, const R& rhs)
+			{
+				os << "max(";
+				lhs.emit(os);
+				os << ", ";
+				rhs.emit(os);
+				os << ")";
+			}
+		};
+	}
+
+	template <class E, class T = void>
+	using enableIfExpr = typename std::enable_if<isExpr<E>::value, T>::type;
+
+	template <class L, class R, class T = void>
+	using enableIfExprs = typename std::enable_if<isExpr<L>::value && isExpr<R>::value, T>::type;
+
+#define ELEMENTWISE_UNARY(fn, opType) \
+	template <class E, class = enableIfExpr<E>> \
+	inline unaryExpr<opType, E> fn(const E& e) { return unaryExpr<opType, E>{ e }; }
+
+#define ELEMENTWISE_BINARY(fn, opType) \
+	template <class L, class R, class = enableIfExprs<L, R>> \
+	inline binaryExpr<opType, L, R> fn(const L& l, const R& r) { return binaryExpr<opType, L, R>{ l, r }; } \
+	template <class L, class = enableIfExpr<L>> \
+	inline binaryExpr<opType, L, constant> fn(const L& l, float r) { return binaryExpr<opType, L, constant>{ l, constant{ r } }; } \
+	template <class R, class = enableIfExpr<R>> \
+	inline binaryExpr<opType, constant, R> fn(float l, const R& r) { return binaryExpr<opType, constant, R>{ constant{ l }, r }; }
+
+	ELEMENTWISE_UNARY(operator-, op::neg)
+	ELEMENTWISE_UNARY(sigmoid, op::sigmoid)
+	ELEMENTWISE_UNARY(exp, op::exp)
+	ELEMENTWISE_UNARY(abs, op::abs)
+	ELEMENTWISE_UNARY(relu, op::relu)
+	ELEMENTWISE_UNARY(tanh, op::tanh)
+	ELEMENTWISE_UNARY(sqrt, op::sqrt)
+
+	ELEMENTWISE_BINARY(operator+, op::add)
+	ELEMENTWISE_BINARY(operator-, op::sub)
+	ELEMENTWISE_BINARY(operator*, op::mul)
+	ELEMENTWISE_BINARY(operator/, op::div)
+	ELEMENTWISE_BINARY(min, op::callMin)
+	ELEMENTWISE_BINARY(max, op::callMax)
+
+#undef ELEMENTWISE_UNARY
+#undef ELEMENTWISE_BINARY
+
+	// Fragment shader for a result expression over arity inputs, each input
+	// already decoded into vec4 x<N>; statements run before the result.
+	inline std::string fragmentSource(int arity, const std::string& resultExpr,
+		const std::string& statements = "", encoding enc = encoding::signedUnorm)
+	{
+		const bool packed = enc == encoding::packedFloat;
+		std::ostringstream os;
+		os << glslPrelude();
+		if (packed)
+			os << floatPacking::glslHelpers();
+		for (int i = 0; i < arity; ++i)
+			os << "    uniform sampler2D input" << i << ";\n";
+		os << "\n    void main(void){\n";
+		for (int i = 0; i < arity; ++i) {
+			const std::string sample = "texture2D(input" + std::to_string(i) + ", v_texCoord)";
+			os << "        vec4 x" << i << " = ";
+			if (packed)
+				os << "vec4(unpackFloat(" << sample << "));\n";
+			else if (enc == encoding::raw)
+				os << sample << ";\n";
+			else
+				os << "u2s(" << sample << ");\n";
+		}
+		os << statements;
+		if (packed)
+			os << "        gl_FragColor = packFloat((" << resultExpr << ").x);\n    }\n";
+		else if (enc == encoding::raw)
+			os << "        gl_FragColor = " << resultExpr << ";\n    }\n";
+		else
+			os << "        gl_FragColor = s2u(" << resultExpr << ");\n    }\n";
+		return os.str();
+	}
+
+	template <class E, class = enableIfExpr<E>>
+	inline std::string fragmentSource(const E& expr, encoding enc = encoding::signedUnorm)
+	{
+		std::ostringstream os;
+		expr.emit(os);
+		return fragmentSource(E::arity, os.str(), "", enc);
+	}
+
+	// A linked elementwise program plus its sampler locations.
+	class kernel
+	{
+		std::shared_ptr<shaderManager> program;
+		std::vector<GLint> samplerLocations;
+		std::string name;
+
+	public:
+		kernel(programRegistry& registry, const std::string& fragmentSource,
+			int arity, const std::string& name = "elementwise")
+			: program{ registry.get(computeQuad::vertexSource(), fragmentSource.c_str()) },
+			name{ name }
+		{
+			for (int i = 0; i < arity; ++i)
+				this->samplerLocations.push_back(
+					this->program->uniformLocation("input" + std::to_string(i)));
+		}
+
+		inline int arity() const
+		{
+			return static_cast<int>(this->samplerLocations.size());
+		}
+
+		inline const shaderManager& getProgram() const
+		{
+			return *(this->program);
+		}
+
+		// Renders the expression over the whole of output, input<N> = inputs[N].
+		void run(const computeQuad& quad, const fboManager& output,
+			const std::vector<textureRef>& inputs) const
+		{
+			if (static_cast<int>(inputs.size()) != this->arity()) {
+				fprintf(stderr, "%s: expected %d inputs, got %d\n", this->name.c_str(),
+					this->arity(), static_cast<int>(inputs.size()));
+				exit(-1);
+			}
+			for (const auto& in : inputs) {
+				if (in.id != 0 && in.id == output.getTexture()) {
+					fprintf(stderr, "%s: output texture is also an input\n", this->name.c_str());
+					exit(-1);
+				}
+			}
+
+			this->program->useProgram();
+			for (size_t i = 0; i < inputs.size(); ++i)
+				inputs[i].bindAsInput(GL_TEXTURE0 + static_cast<GLenum>(i), this->samplerLocations[i]);
+			output.bindFBO();
+			glViewport(0, 0, output.width(), output.height());
+			GPU_PROFILE_SCOPE(this->name.c_str(), gpuOpKind::dispatch);
+			quad.draw();
+		}
+	};
+
+	template <class E, class = enableIfExpr<E>>
+	inline kernel compile(programRegistry& registry, const E& expr,
+		const std::string& name = "elementwise", encoding enc = encoding::signedUnorm)
+	{
+		return kernel(registry, fragmentSource(expr, enc), E::arity, name);
+	}
+}
@@ -3,39 +3,166 @@
 #include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 
+#include <cstdio>
 #include <vector>
 #include <iostream>
 
 #include "macro.h"
+#include "gpuFence.h"
+#include "gpuProfiler.h"
+#include "halfFloat.h"
+#include "traceRecorder.h"
+#include "textureFormat.h"
+#include "textureRef.h"
+
+// Pending readback from fboManager::readPixelsAsync. The fence sits right
+// after the draws, so isReady() can be polled while the host prepares the
+// next batch and get() only blocks if the GPU has not finished yet.
+// Must be resolved on the thread/context that issued it.
+class readbackFuture
+{
+	gpuFence fence;
+	GLuint framebuffer;
+	GLint x, y;
+	GLsizei width, height;
+	GLenum format, type;
+	void* pixels;
+	bool done = false;
+
+public:
+	readbackFuture(GLuint framebuffer, GLint x, GLint y,
+		GLsizei width, GLsizei height, GLenum format,
+		GLenum type, void* pixels)
+		: framebuffer{ framebuffer }, x{ x }, y{ y },
+		width{ width }, height{ height }, format{ format },
+		type{ type }, pixels{ pixels }
+	{
+	}
+
+	readbackFuture(readbackFuture&&) = default;
+	readbackFuture& operator=(readbackFuture&&) = default;
+
+	inline bool isReady()
+	{
+		return this->done || this->fence.isSignaled();
+	}
+
+	// waits for the fence, then copies into the caller's buffer
+	void* get()
+	{
+		if (this->done)
+			return this->pixels;
+		{
+			TRACE_SCOPE("readbackFuture::wait", "sync");
+			this->fence.wait();
+		}
+		GPU_PROFILE_SCOPE("fboManager::readPixelsAsync", gpuOpKind::readback);
+		TRACE_SCOPE_NAMED(trace, "fboManager::readPixelsAsync", "readback");
+		trace.arg("width", this->width).arg("height", this->height)
+			.arg("bytes", int64_t(this->width) * this->height * traceRecorder::pixelSize(this->format, this->type));
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+		glReadPixels(this->x, this->y, this->width, this->height,
+			this->format, this->type, this->pixels);
+		glBindFramebuffer(GL_FRAMEBUFFER, previous);
+		this->done = true;
+		return this->pixels;
+	}
+};
+
+// renderbuffer: write-only target, read back with readPixels
+// texture: render-to-texture, the result can be sampled by the next kernel
+enum class fboAttachment
+{
+	renderbuffer,
+	texture
+};
 
 class fboManager
 {
 	GLuint framebuffer;
-	GLuint renderbuffer;
+	GLuint renderbuffer = 0;
+	GLuint texture = 0;
+	// false when rendering into a texture owned elsewhere
+	bool ownsTexture = true;
+	const fboAttachment attachment;
+	const textureFormat& fmt;
 	const GLsizei frameWidth;
 	const GLsizei frameHeight;
 	const GLsizei frameElementSize;
 
-public:
-	fboManager(GLuint frameWidth, GLuint frameHeight)
-		: frameWidth(frameWidth), frameHeight(frameHeight), frameElementSize(frameHeight * frameWidth * 4)
+	void attachRenderbuffer()
 	{
-		glGenFramebuffers(1, &(this->framebuffer));
 		glGenRenderbuffers(1, &(this->renderbuffer));
 		glBindRenderbuffer(GL_RENDERBUFFER, this->renderbuffer);
-		glRenderbufferStorage(GL_RENDERBUFFER, TEXTURE_INTERNAL_FMT, this->frameWidth, this->frameHeight);
-		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, this->fmt.renderbufferFormat, this->frameWidth, this->frameHeight);
 		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
 			GL_RENDERBUFFER, this->renderbuffer);
+	}
+
+	void attachTexture()
+	{
+		glGenTextures(1, &(this->texture));
+		glBindTexture(GL_TEXTURE_2D, this->texture);
+		// kernels sample texel centers, so filtering must not blend neighbours
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, this->fmt.internalFormat, this->frameWidth, this->frameHeight,
+			0, this->fmt.format, this->fmt.type, NULL);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, this->texture, 0);
+	}
+
+public:
+	fboManager(GLuint frameWidth, GLuint frameHeight,
+		fboAttachment attachment = fboAttachment::renderbuffer,
+		const textureFormat& format = textureFormat::rgba8())
+		: attachment(attachment), fmt(format), frameWidth(frameWidth), frameHeight(frameHeight),
+		frameElementSize(frameHeight * frameWidth * 4)
+	{
+		if (attachment == fboAttachment::renderbuffer && format.renderbufferFormat == 0) {
+			fprintf(stderr, "fboManager: %s has no renderbuffer format, use fboAttachment::texture\n", format.name);
+			exit(-1);
+		}
+		glGenFramebuffers(1, &(this->framebuffer));
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+		if (this->attachment == fboAttachment::texture)
+			this->attachTexture();
+		else
+			this->attachRenderbuffer();
 		this->clearFBO();
 	}
 
+	// Renders into an existing texture (e.g. one aliasing a gbm or dma-buf
+	// buffer), which the destructor leaves to its owner.
+	fboManager(const textureRef& target, const textureFormat& format = textureFormat::rgba8())
+		: texture(target.id), ownsTexture(false), attachment(fboAttachment::texture), fmt(format),
+		frameWidth(target.width), frameHeight(target.height),
+		frameElementSize(target.height * target.width * 4)
+	{
+		glGenFramebuffers(1, &(this->framebuffer));
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			target.target, this->texture, 0);
+	}
+
 	~fboManager()
 	{
 		EGL_CHECK(glDeleteFramebuffers(1, &(this->framebuffer)));
-		EGL_CHECK(glDeleteFramebuffers(1, &(this->renderbuffer)));
+		if (this->renderbuffer != 0) {
+			EGL_CHECK(glDeleteRenderbuffers(1, &(this->renderbuffer)));
+		}
+		if (this->texture != 0 && this->ownsTexture) {
+			EGL_CHECK(glDeleteTextures(1, &(this->texture)));
+		}
 	}
 
+	fboManager(const fboManager&) = delete;
+	fboManager& operator=(const fboManager&) = delete;
+
 	static GLenum checkCurrentFBOStatus()
 	{
 		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
@@ -82,13 +209,75 @@ public:
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 
+	// 0 unless constructed with fboAttachment::texture
+	inline GLuint getTexture() const
+	{
+		return this->texture;
+	}
+
+	inline GLsizei width() const { return this->frameWidth; }
+	inline GLsizei height() const { return this->frameHeight; }
+	inline const textureFormat& format() const { return this->fmt; }
+
+	// Binds the attached texture to textureUnit and points the sampler uniform
+	// at it, for the program currently in use. Never sample it while this FBO
+	// is the bound render target (feedback loop).
+	inline void bindAsInput(GLenum textureUnit, GLint location) const
+	{
+		this->ref().bindAsInput(textureUnit, location);
+	}
+
+	inline textureRef ref() const
+	{
+		return textureRef{ this->texture, this->frameWidth, this->frameHeight, GL_TEXTURE_2D };
+	}
+
 	inline void readPixels(GLint x, GLint y,
 		GLsizei width, GLsizei height, GLenum format,
 		GLenum type, void* pixels) const
 	{
+		GPU_PROFILE_SCOPE("fboManager::readPixels", gpuOpKind::readback);
+		TRACE_SCOPE_NAMED(trace, "fboManager::readPixels", "readback");
+		trace.arg("width", width).arg("height", height)
+			.arg("bytes", int64_t(width) * height * traceRecorder::pixelSize(format, type));
 		glReadPixels(x, y, width, height, format, type, pixels);
 	}
 
+	// RGBA float32 readback of a float format FBO (bind it first). fp16
+	// targets are read as half floats when the driver offers that, which
+	// halves the transfer, and widened on the host (halfFloat.h).
+	void readFloats(GLint x, GLint y, GLsizei width, GLsizei height, float* values) const
+	{
+		if (!this->fmt.isFloat()) {
+			fprintf(stderr, "fboManager: readFloats on %s target\n", this->fmt.name);
+			exit(-1);
+		}
+		if (this->fmt.type == GL_HALF_FLOAT_OES) {
+			GLint readFormat = 0;
+			GLint readType = 0;
+			glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &readFormat);
+			glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &readType);
+			if (readFormat == GL_RGBA && (readType == GL_HALF_FLOAT_OES || readType == GL_HALF_FLOAT)) {
+				const size_t count = static_cast<size_t>(width) * height * 4;
+				std::vector<hfloat> halves(count);
+				this->readPixels(x, y, width, height, GL_RGBA, readType, halves.data());
+				TRACE_SCOPE("fboManager::fromHalfFloat", "readback");
+				halfFloat::toFloat(halves.data(), count, values);
+				return;
+			}
+		}
+		this->readPixels(x, y, width, height, GL_RGBA, this->fmt.readType(), values);
+	}
+
+	// Fences the commands issued so far and defers glReadPixels to get(),
+	// so the host keeps working instead of draining the pipeline here.
+	inline readbackFuture readPixelsAsync(GLint x, GLint y,
+		GLsizei width, GLsizei height, GLenum format,
+		GLenum type, void* pixels) const
+	{
+		return readbackFuture(this->framebuffer, x, y, width, height, format, type, pixels);
+	}
+
 	void printPixels() const
 	{
 		GLubyte* pixels{ new GLubyte[4 * frameWidth, frameHeight] };
@@ -0,0 +1,156 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FLOAT_PACKING_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FLOAT_PACKING_NEON 1
+#endif
+
+#include "macro.h"
+
+// One IEEE float32 per RGBA8 texel, for full precision on GPUs that can only
+// render to RGBA8: R holds the low mantissa byte, A the sign and high exponent
+// bits, i.e. the bytes of the float on a little-endian host (x86, ARM), so
+// the host side is a copy plus clean-up. Kernels decode with
+// unpackFloat() and encode with packFloat() (glslHelpers()), so an element
+// costs a whole texel: 1/4 the throughput of the vec4 u2s()/s2u() path.
+//
+// The shader side rebuilds exponent and mantissa arithmetically, which needs
+// a fragment highp float with 24 mantissa bits (see isSupported()). Denormals
+// flush to zero and overflow saturates to the largest finite float, on the
+// host (packHost) and in packFloat() alike; NaN becomes zero.
+namespace floatPacking
+{
+	inline const char* glslHelpers()
+	{
+		return R"(
+    #ifdef GL_FRAGMENT_PRECISION_HIGH
+    precision highp float;
+    #endif
+
+    float unpackFloat(vec4 rgba){
+        vec4 b = floor(rgba * 255.0 + vec4(0.5));
+        float negative = step(128.0, b.a);
+        float exponent = (b.a - negative * 128.0) * 2.0 + floor(b.b / 128.0);
+        float mantissa = mod(b.b, 128.0) * 65536.0 + b.g * 256.0 + b.r;
+        if (exponent == 0.0)
+            return 0.0;
+        return (1.0 - 2.0 * negative) * exp2(exponent - 127.0) * (1.0 + mantissa / 8388608.0);
+    }
+
+    vec4 packFloat(float v){
+        float signBit = v < 0.0 ? 128.0 : 0.0;
+        float a = abs(v);
+        if (!(a > 0.0))
+            return vec4(0.0, 0.0, 0.0, signBit / 255.0);
+        // clamped so exp2() stays a normal float at both ends of the range
+        float exponent = clamp(floor(log2(a)), -126.0, 127.0);
+        float scaled = a / exp2(exponent);
+        // log2() is not exact near powers of two
+        if (scaled >= 2.0) { exponent += 1.0; scaled *= 0.5; }
+        if (scaled < 1.0) { exponent -= 1.0; scaled *= 2.0; }
+        float biased = exponent + 127.0;
+        if (biased < 1.0)
+            return vec4(0.0, 0.0, 0.0, signBit / 255.0);
+        float mantissa = floor((scaled - 1.0) * 8388608.0 + 0.5);
+        if (mantissa >= 8388608.0) { mantissa = 0.0; biased += 1.0; }
+        if (biased > 254.0) { biased = 254.0; mantissa = 8388607.0; }
+        vec4 b;
+        b.a = signBit + floor(biased / 2.0);
+        b.b = mod(biased, 2.0) * 128.0 + floor(mantissa / 65536.0);
+        b.g = mod(floor(mantissa / 256.0), 256.0);
+        b.r = mod(mantissa, 256.0);
+        return b / 255.0;
+    }
+)";
+	}
+
+	// true when the fragment stage can decode the 24-bit mantissa
+	inline bool isSupported()
+	{
+		GLint range[2] = { 0, 0 };
+		GLint precision = 0;
+		glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range, &precision);
+		return precision >= 23;
+	}
+
+	// Scalar version of the host conversion: flush denormals, saturate
+	// infinities, zero NaNs. The bytes are otherwise the float's own.
+	inline uint32_t sanitize(uint32_t bits)
+	{
+		const uint32_t sign = bits & 0x80000000u;
+		const uint32_t exponent = bits & 0x7F800000u;
+		if (exponent == 0)
+			return sign;
+		if (exponent == 0x7F800000u)
+			return (bits & 0x007FFFFFu) != 0 ? 0u : (sign | 0x7F7FFFFFu);
+		return bits;
+	}
+
+	// count floats into count RGBA8 texels (4 * count bytes)
+	inline void packHost(const float* values, size_t count, GLubyte* texels)
+	{
+		size_t i = 0;
+#if defined(FLOAT_PACKING_SSE2)
+		const __m128i signMask = _mm_set1_epi32(static_cast<int>(0x80000000u));
+		const __m128i exponentMask = _mm_set1_epi32(0x7F800000);
+		const __m128i mantissaMask = _mm_set1_epi32(0x007FFFFF);
+		const __m128i maxFinite = _mm_set1_epi32(0x7F7FFFFF);
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 4 <= count; i += 4) {
+			const __m128i bits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+			const __m128i sign = _mm_and_si128(bits, signMask);
+			const __m128i exponent = _mm_and_si128(bits, exponentMask);
+			const __m128i isDenormal = _mm_cmpeq_epi32(exponent, zero);
+			const __m128i isSpecial = _mm_cmpeq_epi32(exponent, exponentMask);
+			const __m128i isNaN = _mm_andnot_si128(
+				_mm_cmpeq_epi32(_mm_and_si128(bits, mantissaMask), zero), isSpecial);
+			__m128i out = bits;
+			out = _mm_or_si128(_mm_andnot_si128(isDenormal, out), _mm_and_si128(isDenormal, sign));
+			out = _mm_or_si128(_mm_andnot_si128(isSpecial, out),
+				_mm_and_si128(isSpecial, _mm_or_si128(sign, maxFinite)));
+			out = _mm_andnot_si128(isNaN, out);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(texels + 4 * i), out);
+		}
+#elif defined(FLOAT_PACKING_NEON)
+		const uint32x4_t signMask = vdupq_n_u32(0x80000000u);
+		const uint32x4_t exponentMask = vdupq_n_u32(0x7F800000u);
+		const uint32x4_t mantissaMask = vdupq_n_u32(0x007FFFFFu);
+		const uint32x4_t maxFinite = vdupq_n_u32(0x7F7FFFFFu);
+		const uint32x4_t zero = vdupq_n_u32(0);
+		for (; i + 4 <= count; i += 4) {
+			const uint32x4_t bits = vld1q_u32(reinterpret_cast<const uint32_t*>(values + i));
+			const uint32x4_t sign = vandq_u32(bits, signMask);
+			const uint32x4_t exponent = vandq_u32(bits, exponentMask);
+			const uint32x4_t isDenormal = vceqq_u32(exponent, zero);
+			const uint32x4_t isSpecial = vceqq_u32(exponent, exponentMask);
+			const uint32x4_t isNaN = vbicq_u32(isSpecial, vceqq_u32(vandq_u32(bits, mantissaMask), zero));
+			uint32x4_t out = vbslq_u32(isDenormal, sign, bits);
+			out = vbslq_u32(isSpecial, vorrq_u32(sign, maxFinite), out);
+			out = vbicq_u32(out, isNaN);
+			vst1q_u32(reinterpret_cast<uint32_t*>(texels + 4 * i), out);
+		}
+#endif
+		for (; i < count; ++i) {
+			uint32_t bits;
+			memcpy(&bits, values + i, sizeof(bits));
+			bits = sanitize(bits);
+			memcpy(texels + 4 * i, &bits, sizeof(bits));
+		}
+	}
+
+	// count RGBA8 texels back into floats; the bytes already are IEEE floats
+	inline void unpackHost(const GLubyte* texels, size_t count, float* values)
+	{
+		memcpy(values, texels, count * sizeof(float));
+	}
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <GBM/gbm.h>
+
+#include "macro.h"
+#include "eglImage.h"
+#include "fboManager.h"
+#include "gpuFence.h"
+#include "textureManager.h"
+#include "textureRef.h"
+#include "traceRecorder.h"
+
+// gbm_device on a DRM render node. MALI_GPGPU_DRM_NODE picks the node,
+// otherwise the first of /dev/dri/renderD128..135 that opens.
+class gbmDevice
+{
+	int fd;
+	gbm_device* device;
+
+	gbmDevice(int fd, gbm_device* device)
+		: fd{ fd }, device{ device }
+	{
+	}
+
+public:
+	~gbmDevice()
+	{
+		gbm_device_destroy(this->device);
+		close(this->fd);
+	}
+
+	gbmDevice(const gbmDevice&) = delete;
+	gbmDevice& operator=(const gbmDevice&) = delete;
+
+	// nullptr when no render node supports GBM
+	static std::unique_ptr<gbmDevice> open()
+	{
+		const char* forced = getenv("MALI_GPGPU_DRM_NODE");
+		for (int minor = 128; minor < 136; ++minor) {
+			const std::string path = forced != nullptr ? std::string(forced)
+				: "/dev/dri/renderD" + std::to_string(minor);
+			const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+			if (fd >= 0) {
+				gbm_device* device = gbm_create_device(fd);
+				if (device != nullptr)
+					return std::unique_ptr<gbmDevice>(new gbmDevice(fd, device));
+				close(fd);
+			}
+			if (forced != nullptr)
+				break;
+		}
+		return nullptr;
+	}
+
+	inline gbm_device* get() const { return this->device; }
+};
+
+// Tensor stored in a linear gbm buffer object that both the CPU and the
+// GPU address directly: on unified-memory SoCs there is no glTexImage2D
+// upload and no glReadPixels readback. The bo is exported as a dma-buf and
+// imported as an EGLImage (see eglImage.h), so kernels sample it through
+// ref() and render into it through target(); the host reads and writes it
+// through map().
+//
+// Synchronisation is the caller's side of the bargain: a mapping waits for
+// the GPU work issued so far (gpuFence) before handing out the pointer, and
+// a write mapping must be destroyed before a kernel samples the tensor.
+class gbmTensor
+{
+	gbm_bo* bo;
+	int dmaBufFd = -1;
+	const GLsizei tensorWidth;
+	const GLsizei tensorHeight;
+	const textureFormat* format;
+	std::unique_ptr<textureManager> texture;
+	std::unique_ptr<fboManager> framebuffer;
+
+public:
+	// CPU view of the whole bo, unmapped on destruction. Rows are stride()
+	// bytes apart, which is usually more than width * bytes per texel.
+	class mapping
+	{
+		gbm_bo* bo;
+		void* mapData = nullptr;
+		void* pixels;
+		uint32_t rowStride = 0;
+
+	public:
+		mapping(gbm_bo* bo, GLsizei width, GLsizei height, uint32_t flags)
+			: bo{ bo }
+		{
+			TRACE_SCOPE("gbmTensor::map", "readback");
+			gpuFence().wait();
+			this->pixels = gbm_bo_map(bo, 0, 0, width, height, flags, &(this->rowStride), &(this->mapData));
+			if (this->pixels == nullptr) {
+				fprintf(stderr, "gbmTensor: gbm_bo_map failed\n");
+				exit(-1);
+			}
+		}
+
+		~mapping()
+		{
+			gbm_bo_unmap(this->bo, this->mapData);
+		}
+
+		mapping(const mapping&) = delete;
+		mapping& operator=(const mapping&) = delete;
+
+		inline void* data() const { return this->pixels; }
+		inline uint32_t stride() const { return this->rowStride; }
+	};
+
+	// Needs a current context whose display imports dma-bufs
+	// (eglImage::canImportDmaBuf); exits otherwise, since a copy would
+	// defeat the purpose.
+	gbmTensor(const gbmDevice& device, GLsizei width, GLsizei height,
+		GLenum textureUnit = GL_TEXTURE0, uint32_t fourcc = GBM_FORMAT_ABGR8888)
+		: tensorWidth{ width }, tensorHeight{ height }, format{ drmFormat::toTextureFormat(fourcc) }
+	{
+		if (this->format == nullptr) {
+			fprintf(stderr, "gbmTensor: unsupported fourcc 0x%08x\n", fourcc);
+			exit(-1);
+		}
+		this->bo = gbm_bo_create(device.get(), width, height, fourcc,
+			GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR);
+		if (this->bo == nullptr) {
+			fprintf(stderr, "gbmTensor: gbm_bo_create %dx%d failed\n", width, height);
+			exit(-1);
+		}
+		this->dmaBufFd = gbm_bo_get_fd(this->bo);
+		const dmaBufDesc buffer{ this->dmaBufFd, width, height,
+			static_cast<GLsizei>(gbm_bo_get_stride(this->bo)), 0, fourcc };
+		this->texture.reset(new textureManager(buffer, textureUnit, -1));
+		if (!this->texture->isImported()) {
+			fprintf(stderr, "gbmTensor: EGL cannot import the gbm buffer\n");
+			exit(-1);
+		}
+	}
+
+	~gbmTensor()
+	{
+		// GL objects go before the memory they alias
+		this->framebuffer.reset();
+		this->texture.reset();
+		close(this->dmaBufFd);
+		gbm_bo_destroy(this->bo);
+	}
+
+	gbmTensor(const gbmTensor&) = delete;
+	gbmTensor& operator=(const gbmTensor&) = delete;
+
+	inline GLsizei width() const { return this->tensorWidth; }
+	inline GLsizei height() const { return this->tensorHeight; }
+
+	// kernel input
+	inline textureRef ref() const
+	{
+		return this->texture->ref();
+	}
+
+	// kernel output: an FBO rendering straight into the bo
+	const fboManager& target()
+	{
+		if (!this->framebuffer)
+			this->framebuffer.reset(new fboManager(this->ref(), *(this->format)));
+		return *(this->framebuffer);
+	}
+
+	// flags: GBM_BO_TRANSFER_READ, _WRITE or _READ_WRITE
+	inline std::unique_ptr<mapping> map(uint32_t flags = GBM_BO_TRANSFER_READ_WRITE) const
+	{
+		return std::unique_ptr<mapping>(new mapping(this->bo, this->tensorWidth, this->tensorHeight, flags));
+	}
+};
@@ -0,0 +1,198 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "macro.h"
+#include "computeQuad.h"
+#include "elementwise.h"
+#include "fboManager.h"
+#include "gpuProfiler.h"
+#include "pingPongManager.h"
+#include "programRegistry.h"
+#include "shaderManager.h"
+#include "textureRef.h"
+#include "traceRecorder.h"
+
+// C = alpha * A * B on RGBA textures, A is M x K and B is K x N.
+//
+// Every texel carries 4 consecutive K elements, so both operands are stored
+// K-major: A as a ceil(K/4) x M texture (one row of A per texture row) and B
+// transposed, as a ceil(K/4) x N texture (one column of B per texture row);
+// see packRows()/packColumns(). A fragment produces 4 consecutive columns of
+// one row of C: per K texel it fetches one texel of A and four of B and does
+// four dot products. C is a ceil(N/4) x M texture; lanes past N are garbage.
+//
+// The K loop is generated per pass: chunks of `unroll` texels inside a
+// constant-bound loop, then the remainder straight-line. GLES2 cannot report
+// the fragment instruction limit, so K is split into passes of at most
+// texelsPerPass texels, each adding its partial product to the previous pass
+// through a pingPongManager. Lower texelsPerPass if a long K fails to link.
+//
+// Values use the u2s()/s2u() encoding, so pick alpha (e.g. 1/K) to keep every
+// partial sum in [-1, 1]; each pass rounds the accumulator to 8 bits.
+class gemm
+{
+	programRegistry& registry;
+	const computeQuad& quad;
+	const int texelsPerPass;
+	const int unroll;
+
+	// accumulators, kept while the output size stays the same
+	std::unique_ptr<pingPongManager> accumulator;
+
+	std::string fragmentSource(int texels, bool accumulate) const
+	{
+		std::ostringstream os;
+		os << elementwise::glslPrelude();
+		os << R"(
+    #ifdef GL_FRAGMENT_PRECISION_HIGH
+    precision highp float;
+    #endif
+    uniform sampler2D matA;
+    uniform sampler2D matB;
+    uniform sampler2D partial;
+    uniform vec2 sizeA;
+    uniform vec2 sizeB;
+    uniform float kBegin;
+    uniform float alpha;
+)";
+		// one K texel: a row of A against four columns of B
+		const char* step =
+			"            u = k / sizeA.x;\n"
+			"            a = u2s(texture2D(matA, vec2(u, rowA)));\n"
+			"            acc += vec4(dot(a, u2s(texture2D(matB, vec2(u, rowsB.x)))),\n"
+			"                dot(a, u2s(texture2D(matB, vec2(u, rowsB.y)))),\n"
+			"                dot(a, u2s(texture2D(matB, vec2(u, rowsB.z)))),\n"
+			"                dot(a, u2s(texture2D(matB, vec2(u, rowsB.w)))));\n"
+			"            k += 1.0;\n";
+
+		os << "\n    void main(void){\n";
+		os << "        float rowA = (floor(gl_FragCoord.y) + 0.5) / sizeA.y;\n";
+		os << "        vec4 rowsB = (vec4(floor(gl_FragCoord.x) * 4.0) + vec4(0.5, 1.5, 2.5, 3.5)) / sizeB.y;\n";
+		os << "        vec4 acc = vec4(0.0);\n";
+		os << "        vec4 a;\n";
+		os << "        float u;\n";
+		os << "        float k = kBegin + 0.5;\n";
+		const int chunks = texels / this->unroll;
+		if (chunks > 0) {
+			os << "        for (int i = 0; i < " << chunks << "; ++i) {\n";
+			for (int i = 0; i < this->unroll; ++i)
+				os << step;
+			os << "        }\n";
+		}
+		for (int i = 0; i < texels % this->unroll; ++i)
+			os << step;
+		if (accumulate)
+			os << "        acc = alpha * acc + u2s(texture2D(partial, v_texCoord));\n";
+		else
+			os << "        acc = alpha * acc;\n";
+		os << "        gl_FragColor = s2u(acc);\n    }\n";
+		return os.str();
+	}
+
+	void pass(const std::shared_ptr<shaderManager>& program, const textureRef& a,
+		const textureRef& bt, GLsizei kBegin, float alpha, bool accumulate)
+	{
+		pingPongManager& acc = *(this->accumulator);
+		TRACE_SCOPE_NAMED(trace, "gemm::pass", "dispatch");
+		trace.arg("kBegin", kBegin);
+		program->useProgram();
+		a.bindAsInput(GL_TEXTURE0, program->uniformLocation("matA"));
+		bt.bindAsInput(GL_TEXTURE1, program->uniformLocation("matB"));
+		if (accumulate)
+			acc.source().bindAsInput(GL_TEXTURE2, program->uniformLocation("partial"));
+		glUniform2f(program->uniformLocation("sizeA"),
+			static_cast<GLfloat>(a.width), static_cast<GLfloat>(a.height));
+		glUniform2f(program->uniformLocation("sizeB"),
+			static_cast<GLfloat>(bt.width), static_cast<GLfloat>(bt.height));
+		glUniform1f(program->uniformLocation("kBegin"), static_cast<GLfloat>(kBegin));
+		glUniform1f(program->uniformLocation("alpha"), alpha);
+		acc.target().bindFBO();
+		glViewport(0, 0, acc.width(), acc.height());
+		GPU_PROFILE_SCOPE("gemm::pass", gpuOpKind::dispatch);
+		this->quad.draw();
+		acc.swap();
+	}
+
+public:
+	gemm(programRegistry& registry, const computeQuad& quad,
+		int texelsPerPass = 16, int unroll = 4)
+		: registry{ registry }, quad{ quad }, texelsPerPass{ texelsPerPass }, unroll{ unroll }
+	{
+		if (texelsPerPass < 1 || unroll < 1) {
+			fprintf(stderr, "gemm: texelsPerPass and unroll must be positive\n");
+			exit(-1);
+		}
+	}
+
+	gemm(const gemm&) = delete;
+	gemm& operator=(const gemm&) = delete;
+
+	// a: packRows(A), bt: packColumns(B). The result stays on the GPU.
+	const fboManager& multiply(const textureRef& a, const textureRef& bt, float alpha = 1.0f)
+	{
+		if (a.width != bt.width) {
+			fprintf(stderr, "gemm: K mismatch, %d vs %d texels\n", a.width, bt.width);
+			exit(-1);
+		}
+		const GLsizei outWidth = (bt.height + 3) / 4;
+		const GLsizei outHeight = a.height;
+		if (!this->accumulator || this->accumulator->width() != outWidth ||
+			this->accumulator->height() != outHeight)
+			this->accumulator.reset(new pingPongManager(outWidth, outHeight));
+
+		TRACE_SCOPE_NAMED(trace, "gemm::multiply", "dispatch");
+		trace.arg("m", a.height).arg("n", bt.height).arg("k", int64_t(a.width) * 4);
+
+		for (GLsizei begin = 0; begin < a.width; begin += this->texelsPerPass) {
+			const int texels = a.width - begin < this->texelsPerPass
+				? a.width - begin : this->texelsPerPass;
+			const bool accumulate = begin > 0;
+			const auto program = this->registry.get(computeQuad::vertexSource(),
+				this->fragmentSource(texels, accumulate).c_str());
+			this->pass(program, a, bt, begin, alpha, accumulate);
+		}
+		return this->accumulator->result();
+	}
+
+	// Row-major rows x cols matrix as a ceil(cols/4) x rows RGBA8 texture.
+	static std::vector<GLubyte> packRows(const float* matrix, GLsizei rows, GLsizei cols)
+	{
+		const GLsizei texels = (cols + 3) / 4;
+		std::vector<GLubyte> pixels(static_cast<size_t>(texels) * rows * 4, elementwise::encodeSigned(0.0f));
+		for (GLsizei r = 0; r < rows; ++r)
+			for (GLsizei c = 0; c < cols; ++c)
+				pixels[(static_cast<size_t>(r) * texels * 4) + c] = elementwise::encodeSigned(matrix[r * cols + c]);
+		return pixels;
+	}
+
+	// Row-major rows x cols matrix, transposed, as a ceil(rows/4) x cols texture.
+	static std::vector<GLubyte> packColumns(const float* matrix, GLsizei rows, GLsizei cols)
+	{
+		const GLsizei texels = (rows + 3) / 4;
+		std::vector<GLubyte> pixels(static_cast<size_t>(texels) * cols * 4, elementwise::encodeSigned(0.0f));
+		for (GLsizei c = 0; c < cols; ++c)
+			for (GLsizei r = 0; r < rows; ++r)
+				pixels[(static_cast<size_t>(c) * texels * 4) + r] = elementwise::encodeSigned(matrix[r * cols + c]);
+		return pixels;
+	}
+
+	// Inverse of packRows() for a readback of the result.
+	static std::vector<float> unpackRows(const GLubyte* pixels, GLsizei rows, GLsizei cols)
+	{
+		const GLsizei texels = (cols + 3) / 4;
+		std::vector<float> matrix(static_cast<size_t>(rows) * cols);
+		for (GLsizei r = 0; r < rows; ++r)
+			for (GLsizei c = 0; c < cols; ++c)
+				matrix[r * cols + c] = elementwise::decodeSigned(pixels[(static_cast<size_t>(r) * texels * 4) + c]);
+		return matrix;
+	}
+};
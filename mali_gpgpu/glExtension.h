@@ -0,0 +1,46 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstring>
+
+// extension strings are space separated, so match whole tokens only
+inline bool hasExtensionToken(const char* extensions, const char* name)
+{
+	if (extensions == nullptr || name == nullptr || *name == '\0')
+		return false;
+	const size_t nameLen = strlen(name);
+	const char* p = extensions;
+	while ((p = strstr(p, name)) != nullptr) {
+		const bool head = (p == extensions) || (p[-1] == ' ');
+		const bool tail = (p[nameLen] == ' ') || (p[nameLen] == '\0');
+		if (head && tail)
+			return true;
+		p += nameLen;
+	}
+	return false;
+}
+
+// pass EGL_NO_DISPLAY to query client extensions (EGL_EXT_client_extensions)
+inline bool hasEGLExtension(EGLDisplay display, const char* name)
+{
+	const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+	if (extensions == nullptr)
+		eglGetError(); // clear EGL_BAD_DISPLAY when client extensions are unsupported
+	return hasExtensionToken(extensions, name);
+}
+
+// requires a current context
+inline bool hasGLExtension(const char* name)
+{
+	return hasExtensionToken(
+		reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS)), name);
+}
+
+template <typename T>
+inline T loadProc(const char* name)
+{
+	return reinterpret_cast<T>(eglGetProcAddress(name));
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <memory>
+#include <string>
+
+#include "macro.h"
+#include "glExtension.h"
+#include "eglContextFactory.h"
+
+// Owns the EGL display/context/surface for the lifetime of the object.
+// Create it once, keep it alive, and build managers/kernels on top of it;
+// every GL object must be destroyed before the context that owns it.
+class GpgpuContext
+{
+	eglContextBundle bundle;
+	std::string glExtensions;
+	const bool ownsDisplay;
+
+	GpgpuContext(const eglContextBundle& bundle, bool ownsDisplay)
+		: bundle{ bundle }, ownsDisplay{ ownsDisplay }
+	{
+		this->glExtensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+	}
+
+public:
+	GpgpuContext()
+		: GpgpuContext(eglContextFactory::create(), true)
+	{
+	}
+
+	~GpgpuContext()
+	{
+		eglContextFactory::destroy(this->bundle, this->ownsDisplay);
+	}
+
+	// New context in root's share group, current on the calling thread.
+	// It does not own the display, so destroy it before root.
+	static std::unique_ptr<GpgpuContext> createShared(const GpgpuContext& root)
+	{
+		return std::unique_ptr<GpgpuContext>(
+			new GpgpuContext(eglContextFactory::createShared(root.bundle), false));
+	}
+
+	GpgpuContext(const GpgpuContext&) = delete;
+	GpgpuContext& operator=(const GpgpuContext&) = delete;
+
+	inline void makeCurrent() const
+	{
+		EGL_CHECK(eglMakeCurrent(this->bundle.display,
+			this->bundle.surface, this->bundle.surface, this->bundle.context));
+	}
+
+	inline void releaseCurrent() const
+	{
+		EGL_CHECK(eglMakeCurrent(this->bundle.display,
+			EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT));
+	}
+
+	inline bool isCurrent() const
+	{
+		return eglGetCurrentContext() == this->bundle.context;
+	}
+
+	// answered from the string cached at creation, no current context needed
+	inline bool hasGLExtension(const char* name) const
+	{
+		return hasExtensionToken(this->glExtensions.c_str(), name);
+	}
+
+	inline bool hasEGLExtension(const char* name) const
+	{
+		return ::hasEGLExtension(this->bundle.display, name);
+	}
+
+	inline EGLDisplay display() const { return this->bundle.display; }
+	inline EGLConfig config() const { return this->bundle.config; }
+	inline EGLContext context() const { return this->bundle.context; }
+	inline EGLSurface surface() const { return this->bundle.surface; }
+	inline eglSurfaceKind surfaceKind() const { return this->bundle.kind; }
+};
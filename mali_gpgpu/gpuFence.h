@@ -0,0 +1,159 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "macro.h"
+#include "glExtension.h"
+
+// Fence inserted into the current context's command stream.
+// Uses EGL_KHR_fence_sync, then GL_APPLE_sync; without either it degrades
+// to glFinish() on wait() and isSignaled() always reports true afterwards.
+class gpuFence
+{
+	struct eglSyncProcs
+	{
+		PFNEGLCREATESYNCKHRPROC create = nullptr;
+		PFNEGLDESTROYSYNCKHRPROC destroy = nullptr;
+		PFNEGLCLIENTWAITSYNCKHRPROC clientWait = nullptr;
+		PFNEGLGETSYNCATTRIBKHRPROC getAttrib = nullptr;
+	};
+
+	struct appleSyncProcs
+	{
+		PFNGLFENCESYNCAPPLEPROC fence = nullptr;
+		PFNGLDELETESYNCAPPLEPROC destroy = nullptr;
+		PFNGLCLIENTWAITSYNCAPPLEPROC clientWait = nullptr;
+		PFNGLGETSYNCIVAPPLEPROC getiv = nullptr;
+	};
+
+	static const eglSyncProcs& egl()
+	{
+		static const eglSyncProcs procs = [] {
+			eglSyncProcs p;
+			p.create = loadProc<PFNEGLCREATESYNCKHRPROC>("eglCreateSyncKHR");
+			p.destroy = loadProc<PFNEGLDESTROYSYNCKHRPROC>("eglDestroySyncKHR");
+			p.clientWait = loadProc<PFNEGLCLIENTWAITSYNCKHRPROC>("eglClientWaitSyncKHR");
+			p.getAttrib = loadProc<PFNEGLGETSYNCATTRIBKHRPROC>("eglGetSyncAttribKHR");
+			return p;
+		}();
+		return procs;
+	}
+
+	static const appleSyncProcs& apple()
+	{
+		static const appleSyncProcs procs = [] {
+			appleSyncProcs p;
+			p.fence = loadProc<PFNGLFENCESYNCAPPLEPROC>("glFenceSyncAPPLE");
+			p.destroy = loadProc<PFNGLDELETESYNCAPPLEPROC>("glDeleteSyncAPPLE");
+			p.clientWait = loadProc<PFNGLCLIENTWAITSYNCAPPLEPROC>("glClientWaitSyncAPPLE");
+			p.getiv = loadProc<PFNGLGETSYNCIVAPPLEPROC>("glGetSyncivAPPLE");
+			return p;
+		}();
+		return procs;
+	}
+
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLSyncKHR eglSync = EGL_NO_SYNC_KHR;
+	GLsync appleSync = nullptr;
+	bool signaled = false;
+
+	void reset()
+	{
+		if (this->eglSync != EGL_NO_SYNC_KHR)
+			egl().destroy(this->display, this->eglSync);
+		if (this->appleSync != nullptr)
+			apple().destroy(this->appleSync);
+		this->eglSync = EGL_NO_SYNC_KHR;
+		this->appleSync = nullptr;
+	}
+
+public:
+	gpuFence()
+	{
+		this->display = eglGetCurrentDisplay();
+		if (hasEGLExtension(this->display, "EGL_KHR_fence_sync") && egl().create != nullptr)
+			this->eglSync = egl().create(this->display, EGL_SYNC_FENCE_KHR, NULL);
+		if (this->eglSync == EGL_NO_SYNC_KHR) {
+			eglGetError();
+			if (hasGLExtension("GL_APPLE_sync") && apple().fence != nullptr)
+				this->appleSync = apple().fence(GL_SYNC_GPU_COMMANDS_COMPLETE_APPLE, 0);
+		}
+		// submit the work ahead of the fence so it can signal without a wait
+		glFlush();
+	}
+
+	~gpuFence()
+	{
+		this->reset();
+	}
+
+	gpuFence(gpuFence&& other) noexcept
+		: display{ other.display }, eglSync{ other.eglSync },
+		appleSync{ other.appleSync }, signaled{ other.signaled }
+	{
+		other.eglSync = EGL_NO_SYNC_KHR;
+		other.appleSync = nullptr;
+	}
+
+	gpuFence& operator=(gpuFence&& other) noexcept
+	{
+		if (this != &other) {
+			this->reset();
+			this->display = other.display;
+			this->eglSync = other.eglSync;
+			this->appleSync = other.appleSync;
+			this->signaled = other.signaled;
+			other.eglSync = EGL_NO_SYNC_KHR;
+			other.appleSync = nullptr;
+		}
+		return *this;
+	}
+
+	gpuFence(const gpuFence&) = delete;
+	gpuFence& operator=(const gpuFence&) = delete;
+
+	// true when the GPU uses a real fence rather than the glFinish fallback
+	inline bool isNative() const
+	{
+		return this->eglSync != EGL_NO_SYNC_KHR || this->appleSync != nullptr;
+	}
+
+	// non-blocking poll
+	bool isSignaled()
+	{
+		if (this->signaled)
+			return true;
+		if (this->eglSync != EGL_NO_SYNC_KHR) {
+			EGLint status = EGL_UNSIGNALED_KHR;
+			egl().getAttrib(this->display, this->eglSync, EGL_SYNC_STATUS_KHR, &status);
+			this->signaled = (status == EGL_SIGNALED_KHR);
+		}
+		else if (this->appleSync != nullptr) {
+			GLint status = GL_UNSIGNALED_APPLE;
+			apple().getiv(this->appleSync, GL_SYNC_STATUS_APPLE, 1, NULL, &status);
+			this->signaled = (status == GL_SIGNALED_APPLE);
+		}
+		return this->signaled;
+	}
+
+	// blocks until every command issued before the fence has completed
+	void wait()
+	{
+		if (this->signaled)
+			return;
+		if (this->eglSync != EGL_NO_SYNC_KHR) {
+			egl().clientWait(this->display, this->eglSync,
+				EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+		}
+		else if (this->appleSync != nullptr) {
+			apple().clientWait(this->appleSync,
+				GL_SYNC_FLUSH_COMMANDS_BIT_APPLE, GL_TIMEOUT_IGNORED_APPLE);
+		}
+		else {
+			glFinish();
+		}
+		this->signaled = true;
+	}
+};
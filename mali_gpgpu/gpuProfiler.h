@@ -0,0 +1,320 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "macro.h"
+#include "glExtension.h"
+
+enum class gpuOpKind
+{
+	dispatch,
+	upload,
+	readback
+};
+
+inline const char* toString(gpuOpKind kind)
+{
+	switch (kind) {
+	case gpuOpKind::dispatch: return "dispatch";
+	case gpuOpKind::upload: return "upload";
+	case gpuOpKind::readback: return "readback";
+	}
+	return "unknown";
+}
+
+// Opt-in per-operation GPU timing, aggregated by name.
+// Scopes are measured with GL_TIME_ELAPSED_EXT queries when
+// GL_EXT_disjoint_timer_query exists; otherwise (and for scopes nested inside
+// a timed one, since only one query may be active) with steady_clock around a
+// glFinish(), which serializes the pipeline but still attributes the time.
+// Enable with MALI_GPGPU_PROFILE=1 or setEnabled(true).
+class gpuProfiler
+{
+public:
+	struct stats
+	{
+		gpuOpKind kind = gpuOpKind::dispatch;
+		uint64_t count = 0;
+		uint64_t totalNs = 0;
+		uint64_t minNs = UINT64_MAX;
+		uint64_t maxNs = 0;
+		uint64_t gpuTimed = 0;   // samples from timer queries
+		uint64_t disjoint = 0;   // samples dropped because of GL_GPU_DISJOINT_EXT
+	};
+
+	class scope
+	{
+		gpuProfiler& profiler;
+		const char* name;
+		gpuOpKind kind;
+		GLuint query = 0;
+		bool active;
+		std::chrono::steady_clock::time_point start;
+
+	public:
+		scope(const char* name, gpuOpKind kind, gpuProfiler& profiler = gpuProfiler::instance())
+			: profiler{ profiler }, name{ name }, kind{ kind }, active{ profiler.isEnabled() }
+		{
+			if (!this->active)
+				return;
+			this->query = this->profiler.beginQuery();
+			if (this->query == 0) {
+				glFinish(); // keep earlier work out of this sample
+				this->start = std::chrono::steady_clock::now();
+			}
+		}
+
+		~scope()
+		{
+			if (!this->active)
+				return;
+			if (this->query != 0) {
+				this->profiler.endQuery(this->query, this->name, this->kind);
+			}
+			else {
+				glFinish();
+				auto elapsed = std::chrono::steady_clock::now() - this->start;
+				this->profiler.record(this->name, this->kind, static_cast<uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()), false);
+			}
+		}
+
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+	};
+
+private:
+	struct pendingQuery
+	{
+		GLuint query;
+		EGLContext context;
+		std::string name;
+		gpuOpKind kind;
+	};
+
+	struct timerProcs
+	{
+		PFNGLGENQUERIESEXTPROC genQueries = nullptr;
+		PFNGLDELETEQUERIESEXTPROC deleteQueries = nullptr;
+		PFNGLBEGINQUERYEXTPROC beginQuery = nullptr;
+		PFNGLENDQUERYEXTPROC endQuery = nullptr;
+		PFNGLGETQUERYOBJECTUIVEXTPROC getQueryObjectuiv = nullptr;
+		PFNGLGETQUERYOBJECTUI64VEXTPROC getQueryObjectui64v = nullptr;
+	};
+
+	std::mutex mtx;
+	std::atomic<bool> enabled;
+	int timerSupport = -1; // -1 unknown, resolved on first use
+	timerProcs procs;
+	std::map<std::string, stats> table;
+	std::vector<pendingQuery> pending;
+	std::map<EGLContext, std::vector<GLuint>> freeQueries;
+	std::map<EGLContext, bool> queryActive;
+
+	gpuProfiler()
+	{
+		const char* env = getenv("MALI_GPGPU_PROFILE");
+		this->enabled = env != nullptr && *env != '\0' && *env != '0';
+	}
+
+	bool timerAvailable()
+	{
+		if (this->timerSupport < 0) {
+			this->procs.genQueries = loadProc<PFNGLGENQUERIESEXTPROC>("glGenQueriesEXT");
+			this->procs.deleteQueries = loadProc<PFNGLDELETEQUERIESEXTPROC>("glDeleteQueriesEXT");
+			this->procs.beginQuery = loadProc<PFNGLBEGINQUERYEXTPROC>("glBeginQueryEXT");
+			this->procs.endQuery = loadProc<PFNGLENDQUERYEXTPROC>("glEndQueryEXT");
+			this->procs.getQueryObjectuiv = loadProc<PFNGLGETQUERYOBJECTUIVEXTPROC>("glGetQueryObjectuivEXT");
+			this->procs.getQueryObjectui64v = loadProc<PFNGLGETQUERYOBJECTUI64VEXTPROC>("glGetQueryObjectui64vEXT");
+			this->timerSupport = hasGLExtension("GL_EXT_disjoint_timer_query") &&
+				this->procs.genQueries && this->procs.deleteQueries &&
+				this->procs.beginQuery && this->procs.endQuery &&
+				this->procs.getQueryObjectuiv && this->procs.getQueryObjectui64v;
+		}
+		return this->timerSupport == 1;
+	}
+
+	// 0 when a query cannot be used (no extension, or one already running)
+	GLuint beginQuery()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		if (!this->timerAvailable())
+			return 0;
+		const EGLContext context = eglGetCurrentContext();
+		bool& active = this->queryActive[context];
+		if (active)
+			return 0;
+		auto& pool = this->freeQueries[context];
+		GLuint query = 0;
+		if (pool.empty()) {
+			this->procs.genQueries(1, &query);
+		}
+		else {
+			query = pool.back();
+			pool.pop_back();
+		}
+		this->procs.beginQuery(GL_TIME_ELAPSED_EXT, query);
+		active = true;
+		return query;
+	}
+
+	void endQuery(GLuint query, const char* name, gpuOpKind kind)
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		const EGLContext context = eglGetCurrentContext();
+		this->procs.endQuery(GL_TIME_ELAPSED_EXT);
+		this->queryActive[context] = false;
+		this->pending.push_back(pendingQuery{ query, context, name, kind });
+	}
+
+	void recordLocked(const std::string& name, gpuOpKind kind, uint64_t ns, bool gpuTimed)
+	{
+		stats& s = this->table[name];
+		s.kind = kind;
+		s.count += 1;
+		s.totalNs += ns;
+		s.minNs = std::min(s.minNs, ns);
+		s.maxNs = std::max(s.maxNs, ns);
+		if (gpuTimed)
+			s.gpuTimed += 1;
+	}
+
+public:
+	static gpuProfiler& instance()
+	{
+		static gpuProfiler profiler;
+		return profiler;
+	}
+
+	gpuProfiler(const gpuProfiler&) = delete;
+	gpuProfiler& operator=(const gpuProfiler&) = delete;
+
+	inline bool isEnabled() const
+	{
+		return this->enabled;
+	}
+
+	inline void setEnabled(bool enabled)
+	{
+		this->enabled = enabled;
+	}
+
+	void record(const std::string& name, gpuOpKind kind, uint64_t ns, bool gpuTimed)
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->recordLocked(name, kind, ns, gpuTimed);
+	}
+
+	// Folds finished queries of the current context into the table.
+	// With wait, blocks until every query issued on this context resolves.
+	void collect(bool wait = false)
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		if (this->pending.empty())
+			return;
+		const EGLContext context = eglGetCurrentContext();
+		if (wait)
+			glFinish();
+		// a disjoint event (frequency change, context loss...) invalidates
+		// every query in flight, so those samples are dropped
+		GLint disjoint = 0;
+		glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+		auto it = this->pending.begin();
+		while (it != this->pending.end()) {
+			if (it->context != context) {
+				++it;
+				continue;
+			}
+			GLuint available = 0;
+			this->procs.getQueryObjectuiv(it->query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+			if (!available && !wait) {
+				++it;
+				continue;
+			}
+			GLuint64 ns = 0;
+			this->procs.getQueryObjectui64v(it->query, GL_QUERY_RESULT_EXT, &ns);
+			if (disjoint)
+				this->table[it->name].disjoint += 1;
+			else
+				this->recordLocked(it->name, it->kind, ns, true);
+			this->freeQueries[context].push_back(it->query);
+			it = this->pending.erase(it);
+		}
+	}
+
+	// Deletes the current context's query objects; call before destroying it.
+	void releaseContext()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		const EGLContext context = eglGetCurrentContext();
+		auto& pool = this->freeQueries[context];
+		for (auto it = this->pending.begin(); it != this->pending.end();) {
+			if (it->context == context) {
+				pool.push_back(it->query);
+				it = this->pending.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+		if (!pool.empty())
+			this->procs.deleteQueries(static_cast<GLsizei>(pool.size()), pool.data());
+		this->freeQueries.erase(context);
+		this->queryActive.erase(context);
+	}
+
+	std::map<std::string, stats> snapshot()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		return this->table;
+	}
+
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->table.clear();
+	}
+
+	void report(std::ostream& os)
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		os << std::left << std::setw(32) << "name" << std::setw(10) << "kind"
+			<< std::right << std::setw(8) << "count" << std::setw(12) << "total(ms)"
+			<< std::setw(12) << "avg(us)" << std::setw(12) << "min(us)"
+			<< std::setw(12) << "max(us)" << std::setw(8) << "timer" << std::endl;
+		for (const auto& entry : this->table) {
+			const stats& s = entry.second;
+			if (s.count == 0)
+				continue;
+			os << std::left << std::setw(32) << entry.first << std::setw(10) << toString(s.kind)
+				<< std::right << std::setw(8) << s.count
+				<< std::setw(12) << std::fixed << std::setprecision(3) << s.totalNs / 1e6
+				<< std::setw(12) << std::setprecision(1) << s.totalNs / 1e3 / s.count
+				<< std::setw(12) << s.minNs / 1e3
+				<< std::setw(12) << s.maxNs / 1e3
+				<< std::setw(8) << (s.gpuTimed == s.count ? "gpu" : (s.gpuTimed == 0 ? "cpu" : "mixed"))
+				<< std::endl;
+			if (s.disjoint != 0)
+				os << "  (" << s.disjoint << " samples dropped: GPU disjoint)" << std::endl;
+		}
+	}
+};
+
+#define GPU_PROFILE_CONCAT_(a, b) a##b
+#define GPU_PROFILE_CONCAT(a, b) GPU_PROFILE_CONCAT_(a, b)
+#define GPU_PROFILE_SCOPE(name, kind) \
+	gpuProfiler::scope GPU_PROFILE_CONCAT(gpuProfileScope, __LINE__)(name, kind)
@@ -0,0 +1,172 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+#define HALF_FLOAT_F16C 1
+#elif defined(__aarch64__) || (defined(__ARM_NEON) && defined(__ARM_FP) && (__ARM_FP & 2))
+#include <arm_neon.h>
+#define HALF_FLOAT_NEON 1
+#endif
+
+#include "macro.h"
+
+// ES3 token for half floats; ES3 drivers report it instead of
+// GL_HALF_FLOAT_OES as GL_IMPLEMENTATION_COLOR_READ_TYPE of fp16 targets
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+
+// float32 <-> IEEE fp16 (hfloat) for GL_HALF_FLOAT_OES uploads and readbacks.
+// F16C converts 8 values per instruction on x86 (built with -mf16c or
+// /arch:AVX2), vcvt 4 on ARM with fp16 support; everything else and the
+// tails use lookup tables (about 10 KB, built on first use).
+//
+// All paths round to nearest even. Values past 65504 become infinity, small
+// ones fp16 denormals or zero; NaN stays NaN (payload not kept on the
+// table path).
+namespace halfFloat
+{
+	struct tables
+	{
+		// float32 -> fp16, indexed by sign and exponent
+		uint16_t base[512];
+		uint8_t shift[512];
+		// fp16 -> float32
+		uint32_t mantissa[2048];
+		uint32_t exponent[64];
+		uint16_t offset[64];
+
+		tables()
+		{
+			for (int i = 0; i < 256; ++i) {
+				const int e = i - 127;
+				uint16_t b;
+				uint8_t s;
+				if (e < -25) {          // zero; shift past the implicit bit too
+					b = 0;
+					s = 31;
+				}
+				else if (e < -14) {     // fp16 denormal
+					b = static_cast<uint16_t>(0x0400 >> (-e - 14));
+					s = static_cast<uint8_t>(-e - 1);
+				}
+				else if (e <= 15) {     // normal
+					b = static_cast<uint16_t>((e + 15) << 10);
+					s = 13;
+				}
+				else if (e < 128) {     // overflow
+					b = 0x7C00;
+					s = 31;
+				}
+				else {                  // infinity, NaN
+					b = 0x7C00;
+					s = 13;
+				}
+				this->base[i] = b;
+				this->base[i | 0x100] = static_cast<uint16_t>(b | 0x8000);
+				this->shift[i] = s;
+				this->shift[i | 0x100] = s;
+			}
+
+			this->mantissa[0] = 0;
+			for (uint32_t i = 1; i < 1024; ++i) {
+				// denormal: normalize
+				uint32_t m = i << 13;
+				uint32_t e = 0;
+				while (!(m & 0x00800000u)) {
+					e -= 0x00800000u;
+					m <<= 1;
+				}
+				this->mantissa[i] = (m & ~0x00800000u) | (e + 0x38800000u);
+			}
+			for (uint32_t i = 1024; i < 2048; ++i)
+				this->mantissa[i] = 0x38000000u + ((i - 1024) << 13);
+
+			for (uint32_t i = 0; i < 64; ++i) {
+				this->offset[i] = (i == 0 || i == 32) ? 0 : 1024;
+				const uint32_t sign = (i & 32) << 26;
+				if (i == 0 || i == 32)
+					this->exponent[i] = sign;
+				else if (i == 31 || i == 63)   // infinity, NaN
+					this->exponent[i] = sign | 0x47800000u;
+				else
+					this->exponent[i] = sign | ((i & 31) << 23);
+			}
+		}
+	};
+
+	inline const tables& lookup()
+	{
+		static const tables instance;
+		return instance;
+	}
+
+	inline hfloat fromFloat(float value)
+	{
+		const tables& t = lookup();
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		const uint32_t index = bits >> 23;
+		const uint32_t m = bits & 0x007FFFFFu;
+		if ((bits & 0x7F800000u) == 0x7F800000u)
+			return static_cast<hfloat>(t.base[index] | (m != 0 ? 0x0200 | (m >> 13) : 0));
+		const uint32_t s = t.shift[index];
+		// round to nearest even on the significand, implicit bit included;
+		// a carry out of the mantissa bumps the exponent, up to infinity
+		const uint64_t significand = m | 0x00800000u;
+		uint32_t h = t.base[index] + static_cast<uint32_t>(m >> s);
+		const uint64_t half = uint64_t(1) << (s - 1);
+		const uint64_t rest = significand & ((half << 1) - 1);
+		if (rest > half || (rest == half && (h & 1)))
+			++h;
+		return static_cast<hfloat>(h);
+	}
+
+	inline float toFloat(hfloat value)
+	{
+		const tables& t = lookup();
+		const uint32_t bits = t.mantissa[t.offset[value >> 10] + (value & 0x3FF)] + t.exponent[value >> 10];
+		float result;
+		memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+	inline void fromFloat(const float* values, size_t count, hfloat* halves)
+	{
+		size_t i = 0;
+#if defined(HALF_FLOAT_F16C)
+		for (; i + 8 <= count; i += 8) {
+			const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(halves + i), h);
+		}
+#elif defined(HALF_FLOAT_NEON)
+		for (; i + 4 <= count; i += 4)
+			vst1_u16(halves + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(values + i))));
+#endif
+		for (; i < count; ++i)
+			halves[i] = fromFloat(values[i]);
+	}
+
+	inline void toFloat(const hfloat* halves, size_t count, float* values)
+	{
+		size_t i = 0;
+#if defined(HALF_FLOAT_F16C)
+		for (; i + 8 <= count; i += 8) {
+			const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(halves + i));
+			_mm256_storeu_ps(values + i, _mm256_cvtph_ps(h));
+		}
+#elif defined(HALF_FLOAT_NEON)
+		for (; i + 4 <= count; i += 4)
+			vst1q_f32(values + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(halves + i))));
+#endif
+		for (; i < count; ++i)
+			values[i] = toFloat(halves[i]);
+	}
+}
@@ -0,0 +1,329 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "macro.h"
+#include "computeQuad.h"
+#include "elementwise.h"
+#include "fboManager.h"
+#include "programRegistry.h"
+#include "textureRef.h"
+#include "traceRecorder.h"
+
+class lazyGraph;
+
+// Deferred elementwise execution.
+//
+//   lazyGraph graph(registry, quad);
+//   lazyTensor a = graph.input(texA->ref()), b = ..., c = ..., d = ...;
+//   lazyTensor out = (sigmoid(a) * c + sigmoid(b) * d) / 2.0f; // records only
+//   graph.evaluate(out);                                        // one kernel
+//
+// Operations on lazyTensor only record nodes. evaluate() (or read()) is the
+// sync point: the whole elementwise subgraph behind the tensor is fused into
+// one fragment shader, so intermediates never round-trip through memory.
+// The result is kept in a texture-backed FBO and acts as a leaf for later
+// graphs. A subgraph shared by several evaluated tensors is recomputed in
+// each of them rather than written out; on bandwidth-bound GPUs ALU is the
+// cheaper resource.
+namespace lazy
+{
+	struct node
+	{
+		enum class kind { leaf, constant, unary, binary };
+
+		kind type;
+		std::string op;   // GLSL function name or infix symbol
+		bool infix = false;
+		float value = 0.0f;
+		textureRef texture;
+		std::shared_ptr<node> lhs;
+		std::shared_ptr<node> rhs;
+		GLsizei width = 0;
+		GLsizei height = 0;
+		std::shared_ptr<fboManager> result; // set once evaluated
+
+		inline bool isLeaf() const
+		{
+			return this->type == kind::leaf || this->result != nullptr;
+		}
+
+		inline textureRef leafTexture() const
+		{
+			return this->result ? this->result->ref() : this->texture;
+		}
+	};
+
+	// In namespace lazy so that argument-dependent lookup finds the operators
+	// and functions below; the global lazyTensor name is a using-declaration.
+	class lazyTensor
+	{
+		friend class ::lazyGraph;
+
+		lazyGraph* graph = nullptr;
+		std::shared_ptr<lazy::node> n;
+
+		lazyTensor(lazyGraph* graph, std::shared_ptr<lazy::node> n)
+			: graph{ graph }, n{ std::move(n) }
+		{
+		}
+
+	public:
+		lazyTensor() = default;
+
+		inline GLsizei width() const { return this->n->width; }
+		inline GLsizei height() const { return this->n->height; }
+		inline bool isEvaluated() const { return this->n->isLeaf(); }
+
+		inline const std::shared_ptr<lazy::node>& getNode() const { return this->n; }
+		inline lazyGraph* getGraph() const { return this->graph; }
+	};
+}
+
+using lazy::lazyTensor;
+
+class lazyGraph
+{
+	programRegistry& registry;
+	const computeQuad& quad;
+	const elementwise::encoding enc;
+	const textureFormat& format;
+	GLint maxInputs;
+	size_t dispatches = 0;
+
+	// Emits tN = ...; for every interior node once, in dependency order.
+	struct fusion
+	{
+		std::vector<textureRef> inputs;
+		std::unordered_map<const lazy::node*, std::string> names;
+		std::ostringstream statements;
+		int temporaries = 0;
+
+		std::string visit(const std::shared_ptr<lazy::node>& n)
+		{
+			auto it = this->names.find(n.get());
+			if (it != this->names.end())
+				return it->second;
+
+			std::string name;
+			if (n->isLeaf()) {
+				name = "x" + std::to_string(this->inputs.size());
+				this->inputs.push_back(n->leafTexture());
+			}
+			else if (n->type == lazy::node::kind::constant) {
+				name = "vec4(" + elementwise::glslFloat(n->value) + ")";
+			}
+			else {
+				std::string expr;
+				if (n->type == lazy::node::kind::unary) {
+					expr = n->op + "(" + this->visit(n->lhs) + ")";
+				}
+				else {
+					const std::string l = this->visit(n->lhs);
+					const std::string r = this->visit(n->rhs);
+					expr = n->infix ? "(" + l + " " + n->op + " " + r + ")"
+						: n->op + "(" + l + ", " + r + ")";
+				}
+				name = "t" + std::to_string(this->temporaries++);
+				this->statements << "        vec4 " << name << " = " << expr << ";\n";
+			}
+			this->names.emplace(n.get(), name);
+			return name;
+		}
+	};
+
+	// Samplers the fused kernel for n would need (shared leaves counted once
+	// per use, which only errs on the safe side). Whenever a subgraph would
+	// exceed maxInputs, its largest operand is evaluated on its own first, so
+	// an over-wide graph is cut into as few dispatches as the greedy split gives.
+	size_t splitInputs(const std::shared_ptr<lazy::node>& n)
+	{
+		if (n->isLeaf())
+			return 1;
+		if (n->type == lazy::node::kind::constant)
+			return 0;
+		size_t l = this->splitInputs(n->lhs);
+		size_t r = n->rhs ? this->splitInputs(n->rhs) : 0;
+		const size_t limit = static_cast<size_t>(this->maxInputs);
+		while (l + r > limit) {
+			if (l >= r) {
+				this->materialize(n->lhs);
+				l = 1;
+			}
+			else {
+				this->materialize(n->rhs);
+				r = 1;
+			}
+			// x * x: both sides are the node just evaluated
+			if (n->lhs->isLeaf())
+				l = 1;
+			if (n->rhs && n->rhs->isLeaf())
+				r = 1;
+		}
+		return l + r;
+	}
+
+	void materialize(const std::shared_ptr<lazy::node>& n)
+	{
+		if (n->result)
+			return;
+		fusion f;
+		const std::string result = f.visit(n);
+		TRACE_SCOPE_NAMED(trace, "lazyGraph::evaluate", "dispatch");
+		trace.arg("fusedOps", f.temporaries).arg("inputs", static_cast<int64_t>(f.inputs.size()));
+
+		elementwise::kernel k(this->registry,
+			elementwise::fragmentSource(static_cast<int>(f.inputs.size()), result, f.statements.str(), this->enc),
+			static_cast<int>(f.inputs.size()), "lazyGraph::fused");
+		n->result = std::make_shared<fboManager>(n->width, n->height, fboAttachment::texture, this->format);
+		k.run(this->quad, *(n->result), f.inputs);
+		++this->dispatches;
+
+		// the fused subgraph is no longer needed once the result exists
+		n->lhs.reset();
+		n->rhs.reset();
+	}
+
+	std::shared_ptr<lazy::node> make(lazy::node::kind type, const std::string& op, bool infix,
+		const lazyTensor* lhs, const lazyTensor* rhs)
+	{
+		auto n = std::make_shared<lazy::node>();
+		n->type = type;
+		n->op = op;
+		n->infix = infix;
+		const lazyTensor* shape = lhs ? lhs : rhs;
+		n->width = shape->n->width;
+		n->height = shape->n->height;
+		if (lhs && rhs && (lhs->n->width != rhs->n->width || lhs->n->height != rhs->n->height)) {
+			fprintf(stderr, "lazyGraph: shape mismatch %dx%d vs %dx%d in '%s'\n",
+				lhs->n->width, lhs->n->height, rhs->n->width, rhs->n->height, op.c_str());
+			exit(-1);
+		}
+		if (lhs)
+			n->lhs = lhs->n;
+		if (rhs)
+			n->rhs = rhs->n;
+		return n;
+	}
+
+public:
+	// results are stored in format; enc has to match it (raw for float formats)
+	lazyGraph(programRegistry& registry, const computeQuad& quad,
+		elementwise::encoding enc = elementwise::encoding::signedUnorm,
+		const textureFormat& format = textureFormat::rgba8())
+		: registry{ registry }, quad{ quad }, enc{ enc }, format(format)
+	{
+		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &(this->maxInputs));
+		if (this->maxInputs > TEXTURE_UNIT_NUM)
+			this->maxInputs = TEXTURE_UNIT_NUM;
+	}
+
+	lazyGraph(const lazyGraph&) = delete;
+	lazyGraph& operator=(const lazyGraph&) = delete;
+
+	lazyTensor input(const textureRef& texture)
+	{
+		auto n = std::make_shared<lazy::node>();
+		n->type = lazy::node::kind::leaf;
+		n->texture = texture;
+		n->width = texture.width;
+		n->height = texture.height;
+		return lazyTensor(this, n);
+	}
+
+	lazyTensor constant(const lazyTensor& shape, float value)
+	{
+		auto n = std::make_shared<lazy::node>();
+		n->type = lazy::node::kind::constant;
+		n->value = value;
+		n->width = shape.width();
+		n->height = shape.height();
+		return lazyTensor(this, n);
+	}
+
+	lazyTensor unary(const std::string& fn, const lazyTensor& x)
+	{
+		return lazyTensor(this, this->make(lazy::node::kind::unary, fn, false, &x, nullptr));
+	}
+
+	lazyTensor binary(const std::string& op, bool infix, const lazyTensor& l, const lazyTensor& r)
+	{
+		return lazyTensor(this, this->make(lazy::node::kind::binary, op, infix, &l, &r));
+	}
+
+	// Sync point: fuses everything behind t into one dispatch (more if the
+	// fused kernel would need more samplers than GL_MAX_TEXTURE_IMAGE_UNITS).
+	const fboManager& evaluate(const lazyTensor& t)
+	{
+		const auto& n = t.getNode();
+		if (n->result)
+			return *(n->result);
+		if (n->type == lazy::node::kind::leaf) {
+			fprintf(stderr, "lazyGraph: evaluate() on an input tensor\n");
+			exit(-1);
+		}
+
+		this->splitInputs(n);
+		if (!n->result)
+			this->materialize(n);
+		return *(n->result);
+	}
+
+	// evaluate() plus a readback of the whole tensor: float32 RGBA for float
+	// formats (fboManager::readFloats), format.type texels otherwise
+	void read(const lazyTensor& t, void* pixels)
+	{
+		const fboManager& fbo = this->evaluate(t);
+		fbo.bindFBO();
+		if (this->format.isFloat())
+			fbo.readFloats(0, 0, fbo.width(), fbo.height(), static_cast<float*>(pixels));
+		else
+			fbo.readPixels(0, 0, fbo.width(), fbo.height(), this->format.format, this->format.type, pixels);
+	}
+
+	inline size_t dispatchCount() const
+	{
+		return this->dispatches;
+	}
+};
+
+namespace lazy
+{
+#define LAZY_UNARY(fn, glsl) \
+	inline lazyTensor fn(const lazyTensor& x) { return x.getGraph()->unary(glsl, x); }
+
+#define LAZY_BINARY(fn, glsl, isInfix) \
+	inline lazyTensor fn(const lazyTensor& l, const lazyTensor& r) \
+	{ return l.getGraph()->binary(glsl, isInfix, l, r); } \
+	inline lazyTensor fn(const lazyTensor& l, float r) \
+	{ return l.getGraph()->binary(glsl, isInfix, l, l.getGraph()->constant(l, r)); } \
+	inline lazyTensor fn(float l, const lazyTensor& r) \
+	{ return r.getGraph()->binary(glsl, isInfix, r.getGraph()->constant(r, l), r); }
+
+	LAZY_UNARY(sigmoid, "sigmoid")
+	LAZY_UNARY(exp, "exp")
+	LAZY_UNARY(abs, "abs")
+	LAZY_UNARY(relu, "relu")
+	LAZY_UNARY(tanh, "tanh4")
+	LAZY_UNARY(sqrt, "sqrt")
+	LAZY_UNARY(operator-, "-")
+
+	LAZY_BINARY(operator+, "+", true)
+	LAZY_BINARY(operator-, "-", true)
+	LAZY_BINARY(operator*, "*", true)
+	LAZY_BINARY(operator/, "/", true)
+	LAZY_BINARY(min, "min", false)
+	LAZY_BINARY(max, "max", false)
+
+#undef LAZY_UNARY
+#undef LAZY_BINARY
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "macro.h"
+
+// Layout of an N-element vector in a 2D texture, elementsPerTexel lanes
+// per texel, row-major. The shape is the near-square width x height with
+// width = ceil(sqrt(texels)), so at most one partial row of padding
+// (< width texels) instead of rounding up to a square power of two.
+//
+// glslHelpers() bakes the shape into GLSL functions, prefixed to allow
+// several layouts in one shader:
+//   float <p>Index(vec2 fragCoord)   linear index of the texel's lane 0
+//   vec2  <p>Coord(float index)      texture coordinate holding index
+//   float <p>Lane(float index)       lane of index inside its texel
+//   vec4  <p>Mask(float index)       1.0 for the real elements of the texel
+//                                    whose lane 0 is index, 0.0 for padding
+//   float <p>Fetch(sampler2D, float) raw texel value of one element
+// Indices are floats at <p>Precision (highp when the fragment stage has
+// it, mediump otherwise); declare index arithmetic in the kernel with the
+// same qualifier, since kernels default to mediump. make() rejects
+// layouts whose capacity() exceeds 2^mantissa bits of that precision (the
+// helpers add 0.5 to indices, which costs one bit): 8M elements with a
+// 23-bit highp, 1024 on a mediump-only GPU such as Mali-400. Past that use
+// tiledTensor.
+struct linearLayout
+{
+	size_t elements;
+	int elementsPerTexel;
+	GLsizei width;
+	GLsizei height;
+
+	// largest capacity() the GLSL helpers address exactly; requires a
+	// current context
+	static size_t maxExactIndex()
+	{
+		GLint range[2] = { 0, 0 };
+		GLint precision = 0;
+		glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range, &precision);
+		if (precision <= 0)
+			glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_MEDIUM_FLOAT, range, &precision);
+		return size_t(1) << precision;
+	}
+
+	// maxSize 0: GL_MAX_TEXTURE_SIZE; requires a current context
+	static linearLayout make(size_t elements, int elementsPerTexel = 4, GLsizei maxSize = 0)
+	{
+		if (elements == 0 || elementsPerTexel < 1 || elementsPerTexel > 4) {
+			fprintf(stderr, "linearLayout: bad layout, %zu elements, %d per texel\n", elements, elementsPerTexel);
+			exit(-1);
+		}
+		if (maxSize <= 0)
+			glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+		const size_t texels = (elements + elementsPerTexel - 1) / elementsPerTexel;
+		size_t width = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(texels))));
+		// sqrt of a large size_t may land one off
+		while (width > 1 && (width - 1) * (width - 1) >= texels)
+			--width;
+		while (width * width < texels)
+			++width;
+		const size_t height = (texels + width - 1) / width;
+		if (width > static_cast<size_t>(maxSize) || height > static_cast<size_t>(maxSize)) {
+			fprintf(stderr, "linearLayout: %zu elements need %zux%zu texels, limit %d; use tiledTensor\n",
+				elements, width, height, maxSize);
+			exit(-1);
+		}
+		const linearLayout layout{ elements, elementsPerTexel, static_cast<GLsizei>(width), static_cast<GLsizei>(height) };
+		if (layout.capacity() > maxExactIndex()) {
+			fprintf(stderr, "linearLayout: %zu elements exceed the %zu the fragment float precision indexes exactly; use tiledTensor\n",
+				layout.capacity(), maxExactIndex());
+			exit(-1);
+		}
+		return layout;
+	}
+
+	inline size_t texels() const
+	{
+		return static_cast<size_t>(this->width) * this->height;
+	}
+
+	// elements the texture holds, padding included
+	inline size_t capacity() const
+	{
+		return this->texels() * this->elementsPerTexel;
+	}
+
+	inline GLint texelX(size_t index) const
+	{
+		return static_cast<GLint>((index / this->elementsPerTexel) % this->width);
+	}
+
+	inline GLint texelY(size_t index) const
+	{
+		return static_cast<GLint>((index / this->elementsPerTexel) / this->width);
+	}
+
+	inline int lane(size_t index) const
+	{
+		return static_cast<int>(index % this->elementsPerTexel);
+	}
+
+	// Host buffer in texture order: values, then fill up to capacity().
+	// Pass it to textureManager with a matching format (4 lanes: RGBA).
+	template <typename T>
+	std::vector<T> pad(const T* values, T fill = T()) const
+	{
+		std::vector<T> texels(this->capacity(), fill);
+		for (size_t i = 0; i < this->elements; ++i)
+			texels[i] = values[i];
+		return texels;
+	}
+
+	std::string glslHelpers(const std::string& prefix = "layout") const
+	{
+		const std::string w = std::to_string(this->width) + ".0";
+		const std::string h = std::to_string(this->height) + ".0";
+		const std::string n = std::to_string(this->elements) + ".0";
+		const std::string e = std::to_string(this->elementsPerTexel) + ".0";
+		const std::string hp = prefix + "Precision";
+		std::ostringstream os;
+		os << "\n";
+		os << "#ifdef GL_FRAGMENT_PRECISION_HIGH\n";
+		os << "#define " << hp << " highp\n";
+		os << "#else\n";
+		os << "#define " << hp << " mediump\n";
+		os << "#endif\n\n";
+		os << "    " << hp << " float " << prefix << "Index(" << hp << " vec2 fragCoord){\n";
+		os << "        " << hp << " vec2 texel = floor(fragCoord);\n";
+		os << "        return (texel.y * " << w << " + texel.x) * " << e << ";\n";
+		os << "    }\n\n";
+		// floor((x + 0.5) / n) keeps the integer division exact on GPUs
+		// whose division is a reciprocal multiply
+		os << "    " << hp << " vec2 " << prefix << "Coord(" << hp << " float index){\n";
+		os << "        " << hp << " float texel = floor((index + 0.5) / " << e << ");\n";
+		os << "        " << hp << " float y = floor((texel + 0.5) / " << w << ");\n";
+		os << "        return (vec2(texel - y * " << w << ", y) + vec2(0.5)) / vec2(" << w << ", " << h << ");\n";
+		os << "    }\n\n";
+		os << "    " << hp << " float " << prefix << "Lane(" << hp << " float index){\n";
+		os << "        return index - floor((index + 0.5) / " << e << ") * " << e << ";\n";
+		os << "    }\n\n";
+		os << "    vec4 " << prefix << "Mask(" << hp << " float index){\n";
+		os << "        " << hp << " vec4 lanes = vec4(0.5, 1.5, 2.5, 3.5);\n";
+		os << "        return step(index + lanes, vec4(" << n << ")) * step(lanes, vec4(" << e << "));\n";
+		os << "    }\n\n";
+		os << "    float " << prefix << "Fetch(sampler2D s, " << hp << " float index){\n";
+		os << "        vec4 texel = texture2D(s, " << prefix << "Coord(index));\n";
+		os << "        return dot(texel, vec4(equal(vec4(" << prefix << "Lane(index)), vec4(0.0, 1.0, 2.0, 3.0))));\n";
+		os << "    }\n";
+		return os.str();
+	}
+};
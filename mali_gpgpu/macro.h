@@ -1,17 +1,17 @@
 #pragma once
 typedef unsigned short hfloat;
 
+// host element type of the sample's rgba8 data; managers take a
+// textureFormat (textureFormat.h) chosen at runtime instead
 #define TEXTURE_TYPE GL_UNSIGNED_BYTE
 #define TEXTURE_TYPE_TOKEN GLbyte
-#define TEXTURE_INTERNAL_FMT GL_RGBA8_OES
 #define TEXTURE_FORMAT GL_RGBA
 #define TEXTURE_UNIT_NUM 32
-/*
-#define TEXTURE_TYPE GL_HALF_FLOAT_OES
-#define TEXTURE_TYPE_TOKEN hfloat
-#define TEXTURE_INTERNAL_FMT GL_RGBA16_EXT
-#define TEXTURE_FORMAT GL_RGBA
-*/
+
+// vertex shaders read the full-screen geometry from this attribute,
+// bound to a fixed location so one VAO works with every program
+#define POSITION_ATTRIB_NAME "v_position"
+#define POSITION_ATTRIB_LOCATION 0
 
 #define EGL_CHECK(x) \
     x; \
@@ -6,26 +6,6 @@ constexpr unsigned int uiWidth = texSize;
 constexpr unsigned int uiHeight = texSize;
 constexpr GLuint texElementSize = 4 * texSize * texSize;
 
-HWND hWindow;
-HDC  hDisplay;
-
-/* EGL Configuration */
-EGLint aEGLAttributes[] =
-{
-    EGL_RED_SIZE, 8,
-    EGL_GREEN_SIZE, 8,
-    EGL_BLUE_SIZE, 8,
-    EGL_DEPTH_SIZE, 16,
-    EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-    EGL_NONE
-};
-
-EGLint aEGLContextAttributes[] =
-{
-    EGL_CONTEXT_CLIENT_VERSION, 2,
-    EGL_NONE
-};
-
 const GLchar* vtxsource = R"(
     attribute vec2 v_position;
     varying vec2 v_texCoord;
@@ -84,59 +64,24 @@ const GLchar* flgsource = R"(
 
 int main(int argc, char** argv)
 {
-    EGLDisplay	sEGLDisplay;
-    EGLContext	sEGLContext;
-    EGLSurface	sEGLSurface;
-    EGLConfig	aEGLConfigs[1];
-    EGLint		cEGLConfigs;
-    
-    // Environment Dependent Region Start
-    hDisplay = EGL_DEFAULT_DISPLAY;
-
-    sEGLDisplay = EGL_CHECK(eglGetDisplay(hDisplay));
-
-    EGL_CHECK(eglInitialize(sEGLDisplay, NULL, NULL));
-    EGL_CHECK(eglChooseConfig(sEGLDisplay, aEGLAttributes, aEGLConfigs, 1, &cEGLConfigs));
-
-    if (cEGLConfigs == 0)
-    {
-        printf("No EGL configurations were returned.\n");
-        exit(-1);
-    }
-
-    hWindow = create_window(4, 4);
-
-    sEGLSurface = EGL_CHECK(eglCreateWindowSurface(sEGLDisplay,
-        aEGLConfigs[0], (EGLNativeWindowType)hWindow, NULL));
-
-    // end Environment Dependent Region End
-    if (sEGLSurface == EGL_NO_SURFACE)
-    {
-        printf("Failed to create EGL surface.\n");
-        exit(-1);
-    }
-
-    sEGLContext = EGL_CHECK(eglCreateContext(sEGLDisplay,
-        aEGLConfigs[0], EGL_NO_CONTEXT, aEGLContextAttributes));
-
-    if (sEGLContext == EGL_NO_CONTEXT)
-    {
-        printf("Failed to create EGL context.\n");
-        exit(-1);
-    }
-
-    eglMakeCurrent(sEGLDisplay, sEGLSurface, sEGLSurface, sEGLContext);
+    // surfaceless -> pbuffer -> dummy window, whichever the driver supports first
+    auto gpgpuContext = std::make_unique<GpgpuContext>();
+    std::cerr << "EGL context: " << toString(gpgpuContext->surfaceKind()) << std::endl;
 
     // create program obj
-    auto shaderMng = std::make_unique<shaderManager>(vtxsource, flgsource);
+    // linked binaries are reused across runs when the driver supports it
+    programBinaryCache binaryCache;
+    programRegistry registry(&binaryCache);
+    auto shaderMng = registry.get(vtxsource, flgsource);
     shaderMng->useProgram();
-    auto glslProgram = (shaderMng->glslProgram);
 
     // create FBO
     auto FBOMng = std::make_unique<fboManager>(uiWidth, uiHeight);
     fboManager::checkCurrentFBOStatus(); // check status
 
     // create texture
+    // same-shaped inputs recycle idle textures instead of reallocating
+    texturePool texPool;
     constexpr GLuint arraySize = texElementSize;
 
     std::unique_ptr<TEXTURE_TYPE_TOKEN[]> dataA(new TEXTURE_TYPE_TOKEN[arraySize]);
@@ -144,45 +89,32 @@ int main(int argc, char** argv)
         float hoge = i;
         dataA[i] = i;
     }
-    auto locA = glGetUniformLocation(glslProgram, "textureA");
-    auto texA = std::make_unique<textureManager>(texSize, texSize, dataA.get(), GL_TEXTURE0, locA);
+    auto locA = shaderMng->uniformLocation("textureA");
+    auto texA = std::make_unique<textureManager>(texPool, texSize, texSize, dataA.get(), GL_TEXTURE0, locA);
 
     std::unique_ptr<TEXTURE_TYPE_TOKEN[]> dataB(new TEXTURE_TYPE_TOKEN[arraySize]);
     for (int i = 0; i < arraySize; ++i) {
         dataB[i] = i;
     }
-    auto locB = glGetUniformLocation(glslProgram, "textureB");
-    auto texB = std::make_unique<textureManager>(texSize, texSize, dataB.get(), GL_TEXTURE1, locB);
+    auto locB = shaderMng->uniformLocation("textureB");
+    auto texB = std::make_unique<textureManager>(texPool, texSize, texSize, dataB.get(), GL_TEXTURE1, locB);
 
     std::unique_ptr<TEXTURE_TYPE_TOKEN[]> dataC(new TEXTURE_TYPE_TOKEN[arraySize]);
     for (int i = 0; i < arraySize; ++i) {
         dataC[i] = i;
     }
-    auto locC = glGetUniformLocation(glslProgram, "textureC");
-    auto texC = std::make_unique<textureManager>(texSize, texSize, dataC.get(), GL_TEXTURE2, locC);
+    auto locC = shaderMng->uniformLocation("textureC");
+    auto texC = std::make_unique<textureManager>(texPool, texSize, texSize, dataC.get(), GL_TEXTURE2, locC);
 
     std::unique_ptr<TEXTURE_TYPE_TOKEN[]> dataD(new TEXTURE_TYPE_TOKEN[arraySize]);
     for (int i = 0; i < arraySize; ++i) {
         dataD[i] = i;
     }
-    auto locD = glGetUniformLocation(glslProgram, "textureD");
-    auto texD = std::make_unique<textureManager>(texSize, texSize, dataD.get(), GL_TEXTURE3, locD);
+    auto locD = shaderMng->uniformLocation("textureD");
+    auto texD = std::make_unique<textureManager>(texPool, texSize, texSize, dataD.get(), GL_TEXTURE3, locD);
 
-    // create vertex
-    float vertex_position[] = {
-        -1.0f,  -1.0f,
-        1.0f,  -1.0f,
-        1.0f,   1.0f,
-        -1.0f,  1.0f
-    };
-
-    GLubyte indices[] = {
-        0,1,2,2,3,0
-    };
-
-    auto positionLocation = glGetAttribLocation(glslProgram, "v_position");
-    glEnableVertexAttribArray(positionLocation);
-    glVertexAttribPointer(positionLocation, 2, GL_FLOAT, false, 0, vertex_position);
+    // full-screen triangle, uploaded once
+    auto quad = std::make_unique<computeQuad>();
 
     texA->bind();
     texB->bind();
@@ -191,9 +123,13 @@ int main(int argc, char** argv)
 
     std::unique_ptr<TEXTURE_TYPE_TOKEN[]> pixels(new TEXTURE_TYPE_TOKEN[arraySize]);
     double start = clock();
-    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(GLubyte),
-        GL_UNSIGNED_BYTE, indices);
-    FBOMng->readPixels(0, 0, uiWidth, uiHeight, TEXTURE_FORMAT, TEXTURE_TYPE, pixels.get());
+    {
+        GPU_PROFILE_SCOPE("aggregate", gpuOpKind::dispatch);
+        quad->draw();
+    }
+    auto readback = FBOMng->readPixelsAsync(0, 0, uiWidth, uiHeight, TEXTURE_FORMAT, TEXTURE_TYPE, pixels.get());
+    // host-side work for the next batch can overlap the GPU here
+    readback.get();
 
     double end = clock();
 
@@ -224,12 +160,19 @@ int main(int argc, char** argv)
     end = clock();
     std::cout << (end - start) / CLOCKS_PER_SEC << std::endl;
 
+    // MALI_GPGPU_PROFILE=1 prints per-operation GPU time
+    if (gpuProfiler::instance().isEnabled()) {
+        gpuProfiler::instance().collect(true);
+        gpuProfiler::instance().report(std::cerr);
+        gpuProfiler::instance().releaseContext();
+    }
+
     texA.reset(); texB.reset(); texC.reset(); texD.reset();
+    texPool.clear();
+    quad.reset();
     FBOMng.reset();
     shaderMng.reset();
-    EGL_CHECK(eglMakeCurrent(sEGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT));
-    EGL_CHECK(eglDestroySurface(sEGLDisplay, sEGLSurface));
-    EGL_CHECK(eglDestroyContext(sEGLDisplay, sEGLContext));
-    EGL_CHECK(eglTerminate(sEGLDisplay));
+    registry.clear();
+    gpgpuContext.reset();
     return 0;
 }
\ No newline at end of file
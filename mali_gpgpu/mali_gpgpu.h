@@ -4,10 +4,35 @@
 #include <EGL/egl.h>
 
 #include "macro.h"
+#include "gpuProfiler.h"
+#include "traceRecorder.h"
+#ifdef _WIN32
 #include "window.h"
+#endif
+#include "eglContextFactory.h"
+#include "gpgpuContext.h"
+#include "contextPool.h"
+#include "textureFormat.h"
+#include "texturePool.h"
+#include "eglImage.h"
 #include "fboManager.h"
+#include "pingPongManager.h"
 #include "textureManager.h"
 #include "shaderManager.h"
+#include "programRegistry.h"
+#include "computeQuad.h"
+#include "elementwise.h"
+#include "lazyGraph.h"
+#include "reduction.h"
+#include "gemm.h"
+#include "conv2d.h"
+#include "floatPacking.h"
+#include "halfFloat.h"
+#include "tiledTensor.h"
+#include "linearLayout.h"
+#ifndef _WIN32
+#include "gbmTensor.h"
+#endif
 
 #include <iostream>
 #include <memory>
\ No newline at end of file
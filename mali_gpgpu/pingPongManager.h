@@ -0,0 +1,50 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <utility>
+
+#include "macro.h"
+#include "fboManager.h"
+
+// Two texture-backed render targets for iterative kernels: each pass samples
+// source() and renders into target(), then swap() flips their roles.
+// Allocations are made once and reused for every iteration.
+class pingPongManager
+{
+	fboManager fbo[2];
+	int targetIndex = 0;
+
+public:
+	pingPongManager(GLuint frameWidth, GLuint frameHeight)
+		: fbo{ { frameWidth, frameHeight, fboAttachment::texture },
+			{ frameWidth, frameHeight, fboAttachment::texture } }
+	{
+	}
+
+	pingPongManager(const pingPongManager&) = delete;
+	pingPongManager& operator=(const pingPongManager&) = delete;
+
+	inline fboManager& target() { return this->fbo[this->targetIndex]; }
+	inline fboManager& source() { return this->fbo[1 - this->targetIndex]; }
+
+	// Binds target() as the render target and source() as sampler input.
+	inline void bindPass(GLenum textureUnit, GLint location)
+	{
+		this->target().bindFBO();
+		this->source().bindAsInput(textureUnit, location);
+	}
+
+	// the last pass's output becomes the next pass's input
+	inline void swap()
+	{
+		this->targetIndex = 1 - this->targetIndex;
+	}
+
+	// after swap(), the most recent result lives in source()
+	inline fboManager& result() { return this->source(); }
+
+	inline GLsizei width() const { return this->fbo[0].width(); }
+	inline GLsizei height() const { return this->fbo[0].height(); }
+};
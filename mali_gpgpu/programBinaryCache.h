@@ -0,0 +1,196 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "macro.h"
+#include "glExtension.h"
+
+// 64-bit FNV-1a, chained through seed for multi-part keys
+inline uint64_t fnv1a64(const void* data, size_t size,
+	uint64_t seed = 0xcbf29ce484222325ull)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+// NUL is hashed too, so ("ab", "c") and ("a", "bc") differ
+inline uint64_t fnv1a64(const char* str, uint64_t seed = 0xcbf29ce484222325ull)
+{
+	if (str == nullptr)
+		str = "";
+	return fnv1a64(str, strlen(str) + 1, seed);
+}
+
+// On-disk cache of linked programs via GL_OES_get_program_binary.
+// Entries are keyed by the shader sources plus GL_RENDERER/GL_VERSION, so a
+// driver update misses instead of feeding the driver a stale binary; a binary
+// the driver still rejects falls back to compiling from source.
+class programBinaryCache
+{
+	static constexpr uint32_t fileMagic = 0x4250474d; // "MGPB"
+
+	std::string directory;
+	bool supported;
+	PFNGLGETPROGRAMBINARYOESPROC getProgramBinary;
+	PFNGLPROGRAMBINARYOESPROC programBinary;
+
+	std::string pathFor(uint64_t key) const
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+		return this->directory + "/" + name;
+	}
+
+	// unique per process and call, so concurrent writers of one key never
+	// share a temporary file
+	std::string tmpPathFor(const std::string& path) const
+	{
+		static std::atomic<unsigned> counter{ 0 };
+#ifdef _WIN32
+		const int pid = _getpid();
+#else
+		const int pid = static_cast<int>(getpid());
+#endif
+		return path + "." + std::to_string(pid) + "." + std::to_string(counter++) + ".tmp";
+	}
+
+	void makeDirectory() const
+	{
+#ifdef _WIN32
+		_mkdir(this->directory.c_str());
+#else
+		mkdir(this->directory.c_str(), 0755);
+#endif
+	}
+
+public:
+	// MALI_GPGPU_SHADER_CACHE overrides the default ./shader_cache
+	static std::string defaultDirectory()
+	{
+		const char* env = getenv("MALI_GPGPU_SHADER_CACHE");
+		return (env != nullptr && *env != '\0') ? env : "shader_cache";
+	}
+
+	// requires a current context
+	explicit programBinaryCache(const std::string& directory = defaultDirectory())
+		: directory{ directory }
+	{
+		GLint numFormats = 0;
+		if (hasGLExtension("GL_OES_get_program_binary"))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &numFormats);
+		this->getProgramBinary = loadProc<PFNGLGETPROGRAMBINARYOESPROC>("glGetProgramBinaryOES");
+		this->programBinary = loadProc<PFNGLPROGRAMBINARYOESPROC>("glProgramBinaryOES");
+		this->supported = numFormats > 0 &&
+			this->getProgramBinary != nullptr && this->programBinary != nullptr;
+		if (this->supported)
+			this->makeDirectory();
+	}
+
+	inline bool isSupported() const
+	{
+		return this->supported;
+	}
+
+	static uint64_t key(const GLchar* vtx_s, const GLchar* flg_s)
+	{
+		uint64_t hash = fnv1a64(vtx_s);
+		hash = fnv1a64(flg_s, hash);
+		// the fixed attribute binding is baked into the linked binary
+		const GLint positionLocation = POSITION_ATTRIB_LOCATION;
+		hash = fnv1a64(POSITION_ATTRIB_NAME, hash);
+		hash = fnv1a64(&positionLocation, sizeof(positionLocation), hash);
+		hash = fnv1a64(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), hash);
+		hash = fnv1a64(reinterpret_cast<const char*>(glGetString(GL_VERSION)), hash);
+		return hash;
+	}
+
+	// Loads the cached binary into program; false on miss or format mismatch.
+	bool load(GLuint program, uint64_t key) const
+	{
+		if (!this->supported)
+			return false;
+		std::ifstream file(this->pathFor(key), std::ios::binary);
+		if (!file)
+			return false;
+		uint32_t magic = 0;
+		GLenum format = 0;
+		file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+		file.read(reinterpret_cast<char*>(&format), sizeof(format));
+		if (!file || magic != fileMagic)
+			return false;
+		std::vector<char> binary((std::istreambuf_iterator<char>(file)),
+			std::istreambuf_iterator<char>());
+		if (binary.empty())
+			return false;
+
+		this->programBinary(program, format, binary.data(), static_cast<GLint>(binary.size()));
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE) {
+			glGetError(); // GL_INVALID_ENUM on an unknown format
+			return false;
+		}
+		return true;
+	}
+
+	// Stores a linked program; failures only cost the next start a compile.
+	void store(GLuint program, uint64_t key) const
+	{
+		if (!this->supported)
+			return;
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		GLsizei written = 0;
+		this->getProgramBinary(program, length, &written, &format, binary.data());
+		if (written <= 0)
+			return;
+
+		// write aside and rename so a concurrent reader never sees a torn file
+		const std::string path = this->pathFor(key);
+		const std::string tmpPath = this->tmpPathFor(path);
+		{
+			std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+			if (!file)
+				return;
+			const uint32_t magic = fileMagic;
+			file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+			file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+			file.write(binary.data(), written);
+			file.close();
+			if (!file) {
+				remove(tmpPath.c_str());
+				return;
+			}
+		}
+		remove(path.c_str());
+		if (rename(tmpPath.c_str(), path.c_str()) != 0)
+			remove(tmpPath.c_str());
+	}
+};
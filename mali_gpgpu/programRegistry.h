@@ -0,0 +1,62 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "macro.h"
+#include "programBinaryCache.h"
+#include "shaderManager.h"
+
+// Process-wide table of linked programs keyed by a hash of their sources.
+// Asking for the same kernel twice returns the same shaderManager, with its
+// uniform/attribute locations already resolved. Programs live in the share
+// group, so one registry serves every context of a contextPool.
+// clear() it (or destroy it) before the owning GpgpuContext goes away.
+class programRegistry
+{
+	const programBinaryCache* cache;
+	std::mutex mtx;
+	std::unordered_map<uint64_t, std::shared_ptr<shaderManager>> programs;
+
+public:
+	explicit programRegistry(const programBinaryCache* cache = nullptr)
+		: cache{ cache }
+	{
+	}
+
+	programRegistry(const programRegistry&) = delete;
+	programRegistry& operator=(const programRegistry&) = delete;
+
+	static uint64_t key(const GLchar* vtx_s, const GLchar* flg_s)
+	{
+		return fnv1a64(flg_s, fnv1a64(vtx_s));
+	}
+
+	// Returns the linked program for these sources, building it on first use.
+	std::shared_ptr<shaderManager> get(const GLchar* vtx_s, const GLchar* flg_s)
+	{
+		const uint64_t programKey = key(vtx_s, flg_s);
+		std::lock_guard<std::mutex> lock(this->mtx);
+		auto& slot = this->programs[programKey];
+		if (!slot)
+			slot = std::make_shared<shaderManager>(vtx_s, flg_s, this->cache);
+		return slot;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->programs.clear();
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		return this->programs.size();
+	}
+};
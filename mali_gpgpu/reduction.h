@@ -0,0 +1,327 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "macro.h"
+#include "computeQuad.h"
+#include "elementwise.h"
+#include "fboManager.h"
+#include "gpuProfiler.h"
+#include "programRegistry.h"
+#include "shaderManager.h"
+#include "textureRef.h"
+#include "traceRecorder.h"
+
+enum class reduceOp
+{
+	sum,
+	max,
+	min,
+	argmax
+};
+
+inline const char* toString(reduceOp op)
+{
+	switch (op) {
+	case reduceOp::sum: return "sum";
+	case reduceOp::max: return "max";
+	case reduceOp::min: return "min";
+	case reduceOp::argmax: return "argmax";
+	}
+	return "unknown";
+}
+
+struct argmaxResult
+{
+	float value;
+	GLint x;
+	GLint y;
+};
+
+// Multi-pass reduction of a whole texture down to one texel.
+// Every pass renders into a texture FBO factor times smaller on each axis
+// (2: 2x2 taps, 4: 4x4 taps) until 1x1 remains, so only 4 bytes are read
+// back instead of the full map. Odd sizes round up; taps past the source
+// edge are skipped.
+//
+// Values use the u2s()/s2u() encoding of the elementwise kernels:
+//  - sum/max/min reduce each channel independently. On RGBA8 a partial sum
+//    cannot leave [-1, 1], so sum passes store the mean of the input
+//    elements a texel covers, weighting edge taps by their smaller coverage,
+//    and the host scales the final mean by the element count. The mean is
+//    still 8 bits, so a sum is only good to about (element count) / 128:
+//    fine for means and coverage, not for exact totals.
+//  - argmax reduces one channel; R keeps the value and G/B/A the 12-bit x/y
+//    of the winning texel, so inputs are limited to 4096x4096 (1024 on GPUs
+//    without highp fragment floats, whose texel-centre coordinates stop
+//    being exact past that). Ties go to the first tap.
+class reduction
+{
+	programRegistry& registry;
+	const computeQuad& quad;
+	const int factor;
+
+	// intermediate levels, kept while the input size stays the same
+	GLsizei levelsWidth = 0;
+	GLsizei levelsHeight = 0;
+	std::vector<std::unique_ptr<fboManager>> levels;
+
+	// largest argmax side: the 12-bit coordinates, and the (k + 0.5) / size
+	// coordinates of the taps, need highp to stay exact
+	static GLsizei argmaxLimit()
+	{
+		GLint range[2] = { 0, 0 };
+		GLint precision = 0;
+		glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range, &precision);
+		return precision > 0 ? 4096 : 1024;
+	}
+
+	static GLsizei shrink(GLsizei size, int factor)
+	{
+		return (size + factor - 1) / factor;
+	}
+
+	void prepareLevels(GLsizei inputWidth, GLsizei inputHeight)
+	{
+		if (inputWidth == this->levelsWidth && inputHeight == this->levelsHeight)
+			return;
+		this->levels.clear();
+		GLsizei width = inputWidth;
+		GLsizei height = inputHeight;
+		do {
+			width = shrink(width, this->factor);
+			height = shrink(height, this->factor);
+			this->levels.push_back(std::unique_ptr<fboManager>(
+				new fboManager(width, height, fboAttachment::texture)));
+		} while (width > 1 || height > 1);
+		this->levelsWidth = inputWidth;
+		this->levelsHeight = inputHeight;
+	}
+
+	std::string fragmentSource(reduceOp op, bool firstPass, int channel) const
+	{
+		std::ostringstream os;
+		os << elementwise::glslPrelude();
+		os << R"(
+    #ifdef GL_FRAGMENT_PRECISION_HIGH
+    precision highp float;
+    #endif
+    uniform sampler2D input0;
+    uniform vec2 srcSize;
+
+    vec4 tap(vec2 texel){
+        return texture2D(input0, (texel + vec2(0.5)) / srcSize);
+    }
+)";
+		if (op == reduceOp::sum) {
+			// a source texel stands for up to span x span input elements
+			os << R"(
+    uniform vec2 inputSize;
+    uniform float span;
+
+    float weight(vec2 texel){
+        vec2 covered = min(vec2(span), inputSize - texel * span);
+        return covered.x * covered.y;
+    }
+)";
+		}
+		os << "\n    void main(void){\n";
+		os << "        vec2 base = floor(gl_FragCoord.xy) * " << this->factor << ".0;\n";
+		bool first = true;
+		for (int j = 0; j < this->factor; ++j) {
+			for (int i = 0; i < this->factor; ++i) {
+				const std::string texel = "base + vec2(" + std::to_string(i) + ".0, " + std::to_string(j) + ".0)";
+				// tap (0, 0) is always inside the source and seeds the accumulator
+				if (first) {
+					os << "        vec2 t = " << texel << ";\n";
+					if (op == reduceOp::argmax) {
+						if (firstPass) {
+							os << "        float best = u2s(tap(t))[" << channel << "];\n";
+							os << "        vec2 bestAt = t;\n";
+						}
+						else {
+							os << "        vec4 bestTexel = tap(t);\n";
+							os << "        float best = u2s(bestTexel).r;\n";
+						}
+					}
+					else if (op == reduceOp::sum) {
+						os << "        float w = weight(t);\n";
+						os << "        vec4 acc = u2s(tap(t)) * w;\n";
+						os << "        float total = w;\n";
+					}
+					else {
+						os << "        vec4 acc = u2s(tap(t));\n";
+					}
+					first = false;
+					continue;
+				}
+				os << "        t = " << texel << ";\n";
+				os << "        if (t.x < srcSize.x && t.y < srcSize.y) {\n";
+				switch (op) {
+				case reduceOp::sum:
+					os << "            w = weight(t);\n";
+					os << "            acc += u2s(tap(t)) * w;\n";
+					os << "            total += w;\n";
+					break;
+				case reduceOp::max:
+					os << "            acc = max(acc, u2s(tap(t)));\n";
+					break;
+				case reduceOp::min:
+					os << "            acc = min(acc, u2s(tap(t)));\n";
+					break;
+				case reduceOp::argmax:
+					if (firstPass) {
+						os << "            float v = u2s(tap(t))[" << channel << "];\n";
+						os << "            if (v > best) { best = v; bestAt = t; }\n";
+					}
+					else {
+						os << "            vec4 texel = tap(t);\n";
+						os << "            float v = u2s(texel).r;\n";
+						os << "            if (v > best) { best = v; bestTexel = texel; }\n";
+					}
+					break;
+				}
+				os << "        }\n";
+			}
+		}
+		switch (op) {
+		case reduceOp::sum:
+			os << "        gl_FragColor = s2u(acc / total);\n";
+			break;
+		case reduceOp::max:
+		case reduceOp::min:
+			os << "        gl_FragColor = s2u(acc);\n";
+			break;
+		case reduceOp::argmax:
+			if (firstPass) {
+				// x/y low bytes in G/B, their high nibbles packed in A
+				os << "        vec2 hi = floor(bestAt / 256.0);\n";
+				os << "        vec2 lo = bestAt - hi * 256.0;\n";
+				os << "        gl_FragColor = vec4(s2u(vec4(best)).r, lo / 255.0, (hi.x * 16.0 + hi.y) / 255.0);\n";
+			}
+			else {
+				os << "        gl_FragColor = bestTexel;\n";
+			}
+			break;
+		}
+		os << "    }\n";
+		return os.str();
+	}
+
+	// span: input elements per source texel side (factor^level)
+	void pass(const std::shared_ptr<shaderManager>& program, const textureRef& source,
+		const fboManager& target, GLfloat span) const
+	{
+		TRACE_SCOPE_NAMED(trace, "reduction::pass", "dispatch");
+		trace.arg("width", target.width()).arg("height", target.height());
+		program->useProgram();
+		source.bindAsInput(GL_TEXTURE0, program->uniformLocation("input0"));
+		glUniform2f(program->uniformLocation("srcSize"),
+			static_cast<GLfloat>(source.width), static_cast<GLfloat>(source.height));
+		glUniform2f(program->uniformLocation("inputSize"),
+			static_cast<GLfloat>(this->levelsWidth), static_cast<GLfloat>(this->levelsHeight));
+		glUniform1f(program->uniformLocation("span"), span);
+		target.bindFBO();
+		glViewport(0, 0, target.width(), target.height());
+		GPU_PROFILE_SCOPE("reduction::pass", gpuOpKind::dispatch);
+		this->quad.draw();
+	}
+
+	std::array<GLubyte, 4> readResult(const fboManager& result) const
+	{
+		std::array<GLubyte, 4> texel{};
+		result.bindFBO();
+		result.readPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, texel.data());
+		return texel;
+	}
+
+public:
+	reduction(programRegistry& registry, const computeQuad& quad, int factor = 2)
+		: registry{ registry }, quad{ quad }, factor{ factor }
+	{
+		if (factor != 2 && factor != 4) {
+			fprintf(stderr, "reduction: factor must be 2 or 4, got %d\n", factor);
+			exit(-1);
+		}
+	}
+
+	reduction(const reduction&) = delete;
+	reduction& operator=(const reduction&) = delete;
+
+	inline int getFactor() const
+	{
+		return this->factor;
+	}
+
+	// Runs every pass; the 1x1 result stays on the GPU for further kernels.
+	const fboManager& run(const textureRef& input, reduceOp op, int channel = 0)
+	{
+		if (channel < 0 || channel > 3) {
+			fprintf(stderr, "reduction: channel %d out of range\n", channel);
+			exit(-1);
+		}
+		if (op == reduceOp::argmax) {
+			const GLsizei limit = argmaxLimit();
+			if (input.width > limit || input.height > limit) {
+				fprintf(stderr, "reduction: argmax input %dx%d exceeds %dx%d\n",
+					input.width, input.height, limit, limit);
+				exit(-1);
+			}
+		}
+		TRACE_SCOPE_NAMED(trace, "reduction::run", "dispatch");
+		trace.arg("width", input.width).arg("height", input.height);
+
+		this->prepareLevels(input.width, input.height);
+
+		const auto firstProgram = this->registry.get(computeQuad::vertexSource(),
+			this->fragmentSource(op, true, channel).c_str());
+		const auto nextProgram = op == reduceOp::argmax
+			? this->registry.get(computeQuad::vertexSource(), this->fragmentSource(op, false, channel).c_str())
+			: firstProgram;
+
+		GLfloat span = 1.0f;
+		this->pass(firstProgram, input, *(this->levels[0]), span);
+		for (size_t i = 1; i < this->levels.size(); ++i) {
+			span *= static_cast<GLfloat>(this->factor);
+			this->pass(nextProgram, this->levels[i - 1]->ref(), *(this->levels[i]), span);
+		}
+		return *(this->levels.back());
+	}
+
+	// Per-channel sum, max or min of the whole input.
+	std::array<float, 4> reduce(const textureRef& input, reduceOp op)
+	{
+		if (op == reduceOp::argmax) {
+			fprintf(stderr, "reduction: use argmax() for reduceOp::argmax\n");
+			exit(-1);
+		}
+		const auto texel = this->readResult(this->run(input, op));
+		// the sum passes leave the mean of all elements
+		const float scale = op == reduceOp::sum
+			? static_cast<float>(input.width) * static_cast<float>(input.height) : 1.0f;
+		std::array<float, 4> result{};
+		for (int c = 0; c < 4; ++c)
+			result[c] = elementwise::decodeSigned(texel[c]) * scale;
+		return result;
+	}
+
+	// Largest value of one channel and the texel holding it.
+	argmaxResult argmax(const textureRef& input, int channel = 0)
+	{
+		const auto texel = this->readResult(this->run(input, reduceOp::argmax, channel));
+		argmaxResult result;
+		result.value = elementwise::decodeSigned(texel[0]);
+		result.x = texel[1] + ((texel[3] >> 4) << 8);
+		result.y = texel[2] + ((texel[3] & 0xF) << 8);
+		return result;
+	}
+};
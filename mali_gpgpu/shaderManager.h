@@ -4,36 +4,49 @@
 #include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "macro.h"
+#include "programBinaryCache.h"
+#include "traceRecorder.h"
 
 class shaderManager
 {
-	GLuint vertexShader;
-	GLuint fragmentShader;
-public:
-	GLuint glslProgram;
+	GLuint vertexShader = 0;
+	GLuint fragmentShader = 0;
+	std::unordered_map<std::string, GLint> uniformLocations;
+	std::unordered_map<std::string, GLint> attribLocations;
 
-	shaderManager(const GLchar* vtx_s, const GLchar* flg_s)
+	void compileAndLink(const GLchar* vtx_s, const GLchar* flg_s)
 	{
-		this->glslProgram = glCreateProgram();
 		this->vertexShader = glCreateShader(GL_VERTEX_SHADER);
 		this->fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 
-		// set source for shader
-		glShaderSource(this->vertexShader, 1, &vtx_s, NULL);
-		glShaderSource(this->fragmentShader, 1, &flg_s, NULL);
-		// compile shader
-		glCompileShader(this->vertexShader);
-		glCompileShader(this->fragmentShader);
+		{
+			TRACE_SCOPE_NAMED(trace, "shaderManager::compile", "shader");
+			trace.arg("sourceBytes", int64_t(strlen(vtx_s) + strlen(flg_s)));
+			// set source for shader
+			glShaderSource(this->vertexShader, 1, &vtx_s, NULL);
+			glShaderSource(this->fragmentShader, 1, &flg_s, NULL);
+			// compile shader
+			glCompileShader(this->vertexShader);
+			glCompileShader(this->fragmentShader);
+		}
 		// attach shader to Program 
 		glAttachShader(this->glslProgram, this->vertexShader);
 		glAttachShader(this->glslProgram, this->fragmentShader);
+		glBindAttribLocation(this->glslProgram, POSITION_ATTRIB_LOCATION, POSITION_ATTRIB_NAME);
 		// Link into ful program, use fixed function vertex pipleline
-		glLinkProgram(this->glslProgram);
 		GLint linked;
-		glGetProgramiv(this->glslProgram, GL_LINK_STATUS, &linked);
+		{
+			TRACE_SCOPE("shaderManager::link", "shader");
+			glLinkProgram(this->glslProgram);
+			glGetProgramiv(this->glslProgram, GL_LINK_STATUS, &linked);
+		}
 		GLint infoLen = 0;
 		glGetProgramiv(this->glslProgram, GL_INFO_LOG_LENGTH, &infoLen);
 		if (infoLen > 1) {
@@ -44,14 +57,81 @@ public:
 			exit(-1);
 		}
 	}
+
+	// look every active uniform/attribute up once, right after linking
+	void resolveLocations()
+	{
+		GLint count = 0, maxLen = 0;
+		glGetProgramiv(this->glslProgram, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(this->glslProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLen);
+		std::vector<GLchar> name(maxLen > 0 ? maxLen : 1);
+		for (GLint i = 0; i < count; ++i) {
+			GLint size; GLenum type;
+			glGetActiveUniform(this->glslProgram, i, maxLen, NULL, &size, &type, name.data());
+			std::string key(name.data());
+			GLint location = glGetUniformLocation(this->glslProgram, key.c_str());
+			this->uniformLocations[key] = location;
+			// arrays are reported as "name[0]", accept the bare name too
+			const auto bracket = key.find('[');
+			if (bracket != std::string::npos)
+				this->uniformLocations[key.substr(0, bracket)] = location;
+		}
+
+		glGetProgramiv(this->glslProgram, GL_ACTIVE_ATTRIBUTES, &count);
+		glGetProgramiv(this->glslProgram, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLen);
+		name.resize(maxLen > 0 ? maxLen : 1);
+		for (GLint i = 0; i < count; ++i) {
+			GLint size; GLenum type;
+			glGetActiveAttrib(this->glslProgram, i, maxLen, NULL, &size, &type, name.data());
+			this->attribLocations[name.data()] = glGetAttribLocation(this->glslProgram, name.data());
+		}
+	}
+
+public:
+	GLuint glslProgram;
+
+	// with a cache, a stored binary skips the compiler entirely
+	shaderManager(const GLchar* vtx_s, const GLchar* flg_s,
+		const programBinaryCache* cache = nullptr)
+	{
+		this->glslProgram = glCreateProgram();
+		const bool useCache = cache != nullptr && cache->isSupported();
+		const uint64_t cacheKey = useCache ? programBinaryCache::key(vtx_s, flg_s) : 0;
+		bool loaded = false;
+		if (useCache) {
+			TRACE_SCOPE("programBinaryCache::load", "shader");
+			loaded = cache->load(this->glslProgram, cacheKey);
+		}
+		if (!loaded) {
+			this->compileAndLink(vtx_s, flg_s);
+			if (useCache)
+				cache->store(this->glslProgram, cacheKey);
+		}
+		this->resolveLocations();
+	}
 	
 	~shaderManager() 
 	{
 		EGL_CHECK(glDeleteProgram(this->glslProgram));
 	}
 
+	shaderManager(const shaderManager&) = delete;
+	shaderManager& operator=(const shaderManager&) = delete;
+
 	inline void useProgram() {
 		glUseProgram(this->glslProgram);
 	}
-};
 
+	// pre-resolved location, -1 for inactive or unknown names
+	inline GLint uniformLocation(const std::string& name) const
+	{
+		auto it = this->uniformLocations.find(name);
+		return it != this->uniformLocations.end() ? it->second : -1;
+	}
+
+	inline GLint attribLocation(const std::string& name) const
+	{
+		auto it = this->attribLocations.find(name);
+		return it != this->attribLocations.end() ? it->second : -1;
+	}
+};
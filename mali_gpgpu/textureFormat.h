@@ -0,0 +1,222 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "macro.h"
+#include "glExtension.h"
+
+// Texel storage of textures and render targets, chosen at runtime.
+// GLES2 textures take unsized formats: the precision comes from the type, so
+// internalFormat == format for every texture. Renderbuffers need a sized
+// format, 0 when the format has none in GLES2 (render into a texture).
+//
+//   rgba8    core (renderbuffer: OES_rgb8_rgba8)
+//   rgba16f  OES_texture_half_float, rendering EXT_color_buffer_half_float
+//   rgba32f  OES_texture_float, rendering has no GLES2 extension: probed
+//   r8, rg8  EXT_texture_rg
+//
+// Without the render extension, isRenderable() asks the driver with a 1x1
+// framebuffer once per process, so select() returns the first candidate this
+// GPU can really render to.
+struct textureFormat
+{
+	const char* name;
+	GLenum internalFormat;
+	GLenum format;
+	GLenum type;
+	GLenum renderbufferFormat;
+	GLsizei channels;
+	GLsizei bytesPerPixel;
+	const char* sampleExtension;  // nullptr: core
+	const char* renderExtension;  // nullptr: core or probe only
+	const char* linearExtension;  // needed for GL_LINEAR, nullptr: core
+
+	inline bool isFloat() const
+	{
+		return this->type == GL_FLOAT || this->type == GL_HALF_FLOAT_OES;
+	}
+
+	inline bool operator==(const textureFormat& other) const
+	{
+		return this->format == other.format && this->type == other.type;
+	}
+
+	inline bool operator!=(const textureFormat& other) const
+	{
+		return !(*this == other);
+	}
+
+	// Portable glReadPixels type for this format's render targets. Half float
+	// targets read as GL_FLOAT: drivers disagree on the half float token
+	// (GL_HALF_FLOAT_OES vs ES3's GL_HALF_FLOAT); fboManager::readFloats()
+	// asks for it first.
+	inline GLenum readType() const
+	{
+		return this->isFloat() ? GL_FLOAT : this->type;
+	}
+
+	// Extension lookup cached per process like the render probe, since every
+	// textureManager asks isFilterable() when it sets up its texture.
+	static bool hasCachedExtension(const char* name)
+	{
+		static std::mutex mtx;
+		static std::map<std::string, bool> known;
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = known.find(name);
+		if (it != known.end())
+			return it->second;
+		const bool present = hasGLExtension(name);
+		known.emplace(name, present);
+		return present;
+	}
+
+	// requires a current context
+	inline bool isSampleable() const
+	{
+		return this->sampleExtension == nullptr || hasCachedExtension(this->sampleExtension);
+	}
+
+	inline bool isFilterable() const
+	{
+		return this->isSampleable() &&
+			(this->linearExtension == nullptr || hasCachedExtension(this->linearExtension));
+	}
+
+	// Can a texture of this format be a color attachment? Requires a current
+	// context; the answer is probed once and shared by every context.
+	bool isRenderable() const
+	{
+		static std::mutex mtx;
+		static std::map<std::pair<GLenum, GLenum>, bool> probed;
+		if (!this->isSampleable())
+			return false;
+		std::lock_guard<std::mutex> lock(mtx);
+		const auto key = std::make_pair(this->format, this->type);
+		auto it = probed.find(key);
+		if (it != probed.end())
+			return it->second;
+		const bool renderable = (this->renderExtension != nullptr && hasCachedExtension(this->renderExtension))
+			|| this->probeRenderable();
+		probed.emplace(key, renderable);
+		return renderable;
+	}
+
+	static const textureFormat& rgba8()
+	{
+		static const textureFormat format{ "rgba8", GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE,
+			GL_RGBA8_OES, 4, 4, nullptr, nullptr, nullptr };
+		return format;
+	}
+
+	static const textureFormat& rgba16f()
+	{
+		static const textureFormat format{ "rgba16f", GL_RGBA, GL_RGBA, GL_HALF_FLOAT_OES,
+			GL_RGBA16F_EXT, 4, 8, "GL_OES_texture_half_float", "GL_EXT_color_buffer_half_float",
+			"GL_OES_texture_half_float_linear" };
+		return format;
+	}
+
+	static const textureFormat& rgba32f()
+	{
+		static const textureFormat format{ "rgba32f", GL_RGBA, GL_RGBA, GL_FLOAT,
+			0, 4, 16, "GL_OES_texture_float", nullptr, "GL_OES_texture_float_linear" };
+		return format;
+	}
+
+	static const textureFormat& r8()
+	{
+		static const textureFormat format{ "r8", GL_RED_EXT, GL_RED_EXT, GL_UNSIGNED_BYTE,
+			GL_R8_EXT, 1, 1, "GL_EXT_texture_rg", "GL_EXT_texture_rg", nullptr };
+		return format;
+	}
+
+	static const textureFormat& rg8()
+	{
+		static const textureFormat format{ "rg8", GL_RG_EXT, GL_RG_EXT, GL_UNSIGNED_BYTE,
+			GL_RG8_EXT, 2, 2, "GL_EXT_texture_rg", "GL_EXT_texture_rg", nullptr };
+		return format;
+	}
+
+	// nullptr for an unknown name
+	static const textureFormat* fromName(const char* name)
+	{
+		for (const textureFormat* format : { &rgba8(), &rgba16f(), &rgba32f(), &r8(), &rg8() }) {
+			if (name != nullptr && strcmp(name, format->name) == 0)
+				return format;
+		}
+		return nullptr;
+	}
+
+	// built-in descriptor with this format/type pair, nullptr if none
+	static const textureFormat* find(GLenum format, GLenum type)
+	{
+		for (const textureFormat* candidate : { &rgba8(), &rgba16f(), &rgba32f(), &r8(), &rg8() }) {
+			if (candidate->format == format && candidate->type == type)
+				return candidate;
+		}
+		return nullptr;
+	}
+
+	// First candidate this GPU can sample and render to; rgba8 always can.
+	static const textureFormat& select(std::initializer_list<const textureFormat*> candidates)
+	{
+		for (const textureFormat* format : candidates) {
+			if (format->isRenderable())
+				return *format;
+		}
+		return rgba8();
+	}
+
+	// Widest-range RGBA format at the least bandwidth: rgba16f, rgba32f, rgba8.
+	// MALI_GPGPU_TEXTURE_FORMAT=<name> overrides the choice (if renderable).
+	static const textureFormat& selectFloat()
+	{
+		const textureFormat* forced = fromName(getenv("MALI_GPGPU_TEXTURE_FORMAT"));
+		if (forced != nullptr && forced->isRenderable())
+			return *forced;
+		return select({ &rgba16f(), &rgba32f() });
+	}
+
+private:
+	bool probeRenderable() const
+	{
+		GLint previousFramebuffer = 0;
+		GLint previousTexture = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+		// the probe must only see its own errors
+		for (GLenum error = glGetError(); error != GL_NO_ERROR; error = glGetError())
+			fprintf(stderr, "textureFormat: pending GL error 0x%04x before probing %s\n", error, this->name);
+
+		GLuint texture = 0, framebuffer = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, this->internalFormat, 1, 1, 0, this->format, this->type, nullptr);
+		bool renderable = glGetError() == GL_NO_ERROR;
+		if (renderable) {
+			glGenFramebuffers(1, &framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+			renderable = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+			glDeleteFramebuffers(1, &framebuffer);
+		}
+		glDeleteTextures(1, &texture);
+		glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+		glBindTexture(GL_TEXTURE_2D, previousTexture);
+		// only the probe's own errors are left in the queue here
+		while (glGetError() != GL_NO_ERROR) {}
+		return renderable;
+	}
+};
@@ -1,12 +1,40 @@
 #pragma once
 #include "macro.h"
+#include "eglImage.h"
+#include "glExtension.h"
+#include "gpuProfiler.h"
+#include "halfFloat.h"
+#include "traceRecorder.h"
+#include "textureFormat.h"
+#include "texturePool.h"
+#include "textureRef.h"
 
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 
 #include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <mutex>
+#include <vector>
+#ifndef _WIN32
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/dma-buf.h>
+#endif
+
+// texel region of a texture, origin at its first row
+struct textureRect
+{
+	GLint x;
+	GLint y;
+	GLsizei width;
+	GLsizei height;
+};
 
 class textureManager
 {
@@ -17,10 +45,117 @@ class textureManager
 	GLuint id;
 	GLsizei textureWidth;
 	GLsizei textureHeight;
+	// owner of the texture storage when built from a texturePool
+	texturePool* pool = nullptr;
+	// imported dma-buf the texture aliases, released after the texture
+	std::unique_ptr<eglImage> image;
 
 	inline GLint getUnitNum() {
 		return this->textureUnit - GL_TEXTURE0;
 	}
+
+	inline bool isFilterable() const
+	{
+		const textureFormat* format = textureFormat::find(this->internalFormat, this->internalType);
+		return format == nullptr || format->isFilterable();
+	}
+
+	inline GLsizei bytesPerTexel() const
+	{
+		const textureFormat* format = textureFormat::find(this->internalFormat, this->internalType);
+		return format != nullptr ? format->bytesPerPixel
+			: traceRecorder::pixelSize(this->internalFormat, this->internalType);
+	}
+
+	static const textureFormat& dmaBufFormat(uint32_t fourcc)
+	{
+		const textureFormat* format = drmFormat::toTextureFormat(fourcc);
+		if (format == nullptr) {
+			fprintf(stderr, "textureManager: unsupported dma-buf fourcc 0x%08x\n", fourcc);
+			exit(-1);
+		}
+		return *format;
+	}
+
+	// fallback of the dma-buf constructor: map the buffer and upload it with
+	// the pitch as row stride, bracketed by DMA_BUF_IOCTL_SYNC for cache
+	// coherency (plain memfds reject the ioctl, which is harmless)
+	void copyDmaBuf(const dmaBufDesc& buffer)
+	{
+#ifndef _WIN32
+		const GLsizei texelBytes = this->bytesPerTexel();
+		if (buffer.pitch % texelBytes != 0) {
+			fprintf(stderr, "textureManager: dma-buf pitch %d is not a multiple of %d\n", buffer.pitch, texelBytes);
+			exit(-1);
+		}
+		const size_t bytes = static_cast<size_t>(buffer.offset) + static_cast<size_t>(buffer.pitch) * buffer.height;
+		size_t size = buffer.size;
+		if (size == 0) {
+			const off_t end = lseek(buffer.fd, 0, SEEK_END);
+			size = end > 0 ? static_cast<size_t>(end) : 0;
+		}
+		if (buffer.offset < 0 || buffer.pitch < buffer.width * texelBytes || size < bytes) {
+			fprintf(stderr, "textureManager: dma-buf of %zu bytes cannot hold %dx%d at pitch %d, offset %d\n",
+				size, buffer.width, buffer.height, buffer.pitch, buffer.offset);
+			exit(-1);
+		}
+		void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, buffer.fd, 0);
+		if (mapped == MAP_FAILED) {
+			fprintf(stderr, "textureManager: cannot map dma-buf fd %d\n", buffer.fd);
+			exit(-1);
+		}
+		struct dma_buf_sync sync = { DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ };
+		ioctl(buffer.fd, DMA_BUF_IOCTL_SYNC, &sync);
+		this->update(textureRect{ 0, 0, buffer.width, buffer.height },
+			static_cast<const GLubyte*>(mapped) + buffer.offset, buffer.pitch / texelBytes);
+		sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+		ioctl(buffer.fd, DMA_BUF_IOCTL_SYNC, &sync);
+		munmap(mapped, bytes);
+#else
+		fprintf(stderr, "textureManager: dma-buf import needs Linux\n");
+		exit(-1);
+#endif
+	}
+
+	// body of the public dma-buf constructor, with the fourcc resolved once
+	textureManager(const dmaBufDesc& buffer, const textureFormat& format, GLenum textureUnit, GLint location)
+		: target{ GL_TEXTURE_2D },
+		internalFormat{ format.format },
+		internalType{ format.type },
+		textureUnit{ textureUnit },
+		textureWidth{ buffer.width },
+		textureHeight{ buffer.height }
+	{
+		glGenTextures(1, &(this->id));
+		glActiveTexture(textureUnit);
+		this->bind();
+		this->setUniformLocation(location);
+		this->setTexParameter();
+		{
+			TRACE_SCOPE("textureManager::importDmaBuf", "upload");
+			this->image = eglImage::fromDmaBuf(eglGetCurrentDisplay(), buffer);
+			if (this->image) {
+				// the check below must only see the bind's own error
+				for (GLenum error = glGetError(); error != GL_NO_ERROR; error = glGetError())
+					fprintf(stderr, "textureManager: pending GL error 0x%04x before dma-buf import\n", error);
+				this->image->bindTexture(this->target);
+				// some drivers import RGB layouts for GL_TEXTURE_EXTERNAL_OES only
+				if (glGetError() == GL_NO_ERROR)
+					return;
+				fprintf(stderr, "textureManager: dma-buf not usable as GL_TEXTURE_2D, copying\n");
+				this->image.reset();
+			}
+		}
+		glTexImage2D(this->target, 0, this->internalFormat, this->textureWidth, this->textureHeight,
+			0, this->internalFormat, this->internalType, nullptr);
+		this->copyDmaBuf(buffer);
+	}
+
+	inline texturePool::bucketKey poolKey() const
+	{
+		return texturePool::bucketKey{ this->textureWidth, this->textureHeight,
+			this->internalFormat, this->internalType };
+	}
 public:
 	textureManager(GLsizei texWidth, GLsizei texHeight,
 		const void* pixels,
@@ -36,6 +171,10 @@ public:
 		internalFormat{ internalFmt },
 		internalType{ type }
 	{
+		GPU_PROFILE_SCOPE("textureManager::upload", gpuOpKind::upload);
+		TRACE_SCOPE_NAMED(trace, "textureManager::upload", "upload");
+		trace.arg("width", texWidth).arg("height", texHeight)
+			.arg("bytes", int64_t(texWidth) * texHeight * traceRecorder::pixelSize(internalFmt, type));
 		glGenTextures(1, &(this->id));
 		glActiveTexture(textureUnit);
 		this->bind();
@@ -46,18 +185,196 @@ public:
 			0, this->internalFormat, this->internalType, pixels);
 	}
 
+	textureManager(GLsizei texWidth, GLsizei texHeight,
+		const void* pixels,
+		GLenum textureUnit,
+		GLint location,
+		const textureFormat& format,
+		GLenum target = GL_TEXTURE_2D)
+		: textureManager(texWidth, texHeight, pixels, textureUnit, location,
+			target, format.format, format.type)
+	{
+	}
+
+	// Recycles an idle texture of the same shape from pool and refreshes it
+	// with glTexSubImage2D; allocates only on a miss. The destructor gives
+	// the texture back to the pool instead of deleting it.
+	textureManager(texturePool& pool, GLsizei texWidth, GLsizei texHeight,
+		const void* pixels,
+		GLenum textureUnit,
+		GLint location,
+		const textureFormat& format = textureFormat::rgba8(),
+		GLenum target = GL_TEXTURE_2D)
+		: target{ target },
+		internalFormat{ format.format },
+		internalType{ format.type },
+		textureUnit{ textureUnit },
+		textureWidth{ texWidth },
+		textureHeight{ texHeight },
+		pool{ &pool }
+	{
+		this->id = pool.acquire(this->poolKey());
+		if (this->id == 0) {
+			GPU_PROFILE_SCOPE("textureManager::upload", gpuOpKind::upload);
+			TRACE_SCOPE_NAMED(trace, "textureManager::upload", "upload");
+			trace.arg("width", texWidth).arg("height", texHeight)
+				.arg("bytes", int64_t(texWidth) * texHeight * format.bytesPerPixel);
+			glGenTextures(1, &(this->id));
+			glActiveTexture(textureUnit);
+			this->bind();
+			this->setUniformLocation(location);
+			this->setTexParameter();
+			glTexImage2D(this->target, 0, this->internalFormat,
+				this->textureWidth, this->textureHeight,
+				0, this->internalFormat, this->internalType, pixels);
+			return;
+		}
+		glActiveTexture(textureUnit);
+		this->bind();
+		this->setUniformLocation(location);
+		this->setTexParameter();
+		if (pixels != nullptr)
+			this->update(pixels);
+	}
+
+	// Samples a dma-buf in place: the texture aliases the buffer through an
+	// EGLImage (EGL_EXT_image_dma_buf_import). Without import support, or
+	// when the driver rejects the buffer, the contents are copied once
+	// instead; isImported() tells which happened. The fd stays owned by the
+	// caller, an imported buffer must outlive this object.
+	textureManager(const dmaBufDesc& buffer, GLenum textureUnit, GLint location)
+		: textureManager(buffer, dmaBufFormat(buffer.fourcc), textureUnit, location)
+	{
+	}
+
+	~textureManager()
+	{
+		if (this->pool != nullptr) {
+			this->pool->release(this->poolKey(), this->id);
+		}
+		else {
+			EGL_CHECK(glDeleteTextures(1, &(this->id)));
+		}
+	}
+
+	textureManager(const textureManager&) = delete;
+	textureManager& operator=(const textureManager&) = delete;
+
+	// float32 texels for a float format; GL_HALF_FLOAT_OES formats are
+	// converted to fp16 on the host (halfFloat.h) and allocated with the
+	// converted data in one glTexImage2D
+	static std::unique_ptr<textureManager> fromFloats(GLsizei texWidth, GLsizei texHeight,
+		const float* values,
+		GLenum textureUnit,
+		GLint location,
+		const textureFormat& format,
+		GLenum target = GL_TEXTURE_2D)
+	{
+		if (!format.isFloat()) {
+			fprintf(stderr, "textureManager: float data for non-float format %s\n", format.name);
+			exit(-1);
+		}
+		std::vector<hfloat> halves;
+		const void* pixels = values;
+		if (values != nullptr && format.type == GL_HALF_FLOAT_OES) {
+			TRACE_SCOPE("textureManager::toHalfFloat", "upload");
+			halves.resize(static_cast<size_t>(texWidth) * texHeight * format.channels);
+			halfFloat::fromFloat(values, halves.size(), halves.data());
+			pixels = halves.data();
+		}
+		return std::unique_ptr<textureManager>(new textureManager(texWidth, texHeight, pixels,
+			textureUnit, location, format, target));
+	}
+
+	// true when the texture samples an imported buffer rather than a copy
+	inline bool isImported() const
+	{
+		return this->image != nullptr;
+	}
+
+	// Replaces the whole level 0 in place, keeping the storage.
+	inline void update(const void* pixels)
+	{
+		GPU_PROFILE_SCOPE("textureManager::update", gpuOpKind::upload);
+		TRACE_SCOPE_NAMED(trace, "textureManager::update", "upload");
+		trace.arg("width", this->textureWidth).arg("height", this->textureHeight)
+			.arg("bytes", int64_t(this->textureWidth) * this->textureHeight
+				* traceRecorder::pixelSize(this->internalFormat, this->internalType));
+		this->bind();
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(this->target, 0, 0, 0, this->textureWidth, this->textureHeight,
+			this->internalFormat, this->internalType, pixels);
+	}
+
+	// Uploads only rect. data points at the texel for (rect.x, rect.y) in a
+	// host image rowStride texels wide (0: rect.width, i.e. tightly packed),
+	// e.g. a dirty region inside a full video frame. With EXT_unpack_subimage
+	// GL reads the strided rows in place through GL_UNPACK_ROW_LENGTH;
+	// without it the rows are first packed into a staging copy.
+	void update(const textureRect& rect, const void* data, GLsizei rowStride = 0)
+	{
+		if (rect.x < 0 || rect.y < 0 || rect.width < 0 || rect.height < 0 ||
+			rect.x + rect.width > this->textureWidth || rect.y + rect.height > this->textureHeight) {
+			fprintf(stderr, "textureManager: update rect %d,%d %dx%d outside %dx%d texture\n",
+				rect.x, rect.y, rect.width, rect.height, this->textureWidth, this->textureHeight);
+			exit(-1);
+		}
+		if (rowStride == 0)
+			rowStride = rect.width;
+		if (rowStride < rect.width) {
+			fprintf(stderr, "textureManager: row stride %d below rect width %d\n", rowStride, rect.width);
+			exit(-1);
+		}
+		if (rect.width == 0 || rect.height == 0)
+			return;
+
+		const size_t texelBytes = static_cast<size_t>(this->bytesPerTexel());
+		GPU_PROFILE_SCOPE("textureManager::update", gpuOpKind::upload);
+		TRACE_SCOPE_NAMED(trace, "textureManager::update", "upload");
+		trace.arg("width", rect.width).arg("height", rect.height)
+			.arg("bytes", int64_t(rect.width) * rect.height * int64_t(texelBytes));
+		this->bind();
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		if (rowStride == rect.width) {
+			glTexSubImage2D(this->target, 0, rect.x, rect.y, rect.width, rect.height,
+				this->internalFormat, this->internalType, data);
+			return;
+		}
+		// looked up once, shared by every context like the other extension checks
+		static const bool unpackSubimage = hasGLExtension("GL_EXT_unpack_subimage");
+		if (unpackSubimage) {
+			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, rowStride);
+			glTexSubImage2D(this->target, 0, rect.x, rect.y, rect.width, rect.height,
+				this->internalFormat, this->internalType, data);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+			return;
+		}
+		const size_t rowBytes = rect.width * texelBytes;
+		const size_t strideBytes = rowStride * texelBytes;
+		std::vector<GLubyte> staging(rowBytes * rect.height);
+		const GLubyte* source = static_cast<const GLubyte*>(data);
+		for (GLsizei row = 0; row < rect.height; ++row)
+			memcpy(&staging[row * rowBytes], source + row * strideBytes, rowBytes);
+		glTexSubImage2D(this->target, 0, rect.x, rect.y, rect.width, rect.height,
+			this->internalFormat, this->internalType, staging.data());
+	}
+
 	inline void setTexParameter() {
 		this->bind();
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		// float textures are incomplete with GL_LINEAR unless the *_linear extension exists
+		const GLint filter = this->isFilterable() ? GL_LINEAR : GL_NEAREST;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
 	}
 
+	// location -1 skips the sampler setup, for textures bound later by a kernel
 	inline void setUniformLocation(GLint location) {
 		this->bind();
-		glUniform1i(location, this->getUnitNum());
+		if (location >= 0)
+			glUniform1i(location, this->getUnitNum());
 	}
 
 	inline void bind() const
@@ -69,4 +386,14 @@ public:
 	{
 		glBindTexture(this->target, 0);
 	}
+
+	inline textureRef ref() const
+	{
+		return textureRef{ this->id, this->textureWidth, this->textureHeight, this->target };
+	}
+
+	inline void bindAsInput(GLenum textureUnit, GLint location) const
+	{
+		this->ref().bindAsInput(textureUnit, location);
+	}
 };
\ No newline at end of file
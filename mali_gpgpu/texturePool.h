@@ -0,0 +1,136 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "macro.h"
+
+// Idle textures bucketed by (width, height, format, type), so a stream of
+// same-shaped inputs reuses the storage the driver already allocated:
+// textureManager takes a texture from its bucket and refreshes it with
+// glTexSubImage2D, and only a shape miss pays for glGenTextures plus
+// glTexImage2D. A released texture keeps its storage (and contents) until
+// acquired again or dropped because its bucket is full.
+//
+// Textures live in the share group, so one pool serves every context of a
+// contextPool. clear() it (or destroy it) before the owning GpgpuContext
+// goes away, after the textureManagers drawing from it.
+class texturePool
+{
+public:
+	struct bucketKey
+	{
+		GLsizei width;
+		GLsizei height;
+		GLenum format;
+		GLenum type;
+
+		inline bool operator==(const bucketKey& other) const
+		{
+			return this->width == other.width && this->height == other.height &&
+				this->format == other.format && this->type == other.type;
+		}
+	};
+
+private:
+	struct bucketHash
+	{
+		size_t operator()(const bucketKey& key) const
+		{
+			size_t h = std::hash<GLsizei>()(key.width);
+			h = h * 31 + std::hash<GLsizei>()(key.height);
+			h = h * 31 + std::hash<GLenum>()(key.format);
+			return h * 31 + std::hash<GLenum>()(key.type);
+		}
+	};
+
+	const size_t maxIdlePerBucket;
+	std::mutex mtx;
+	std::unordered_map<bucketKey, std::vector<GLuint>, bucketHash> idle;
+	size_t hitCount = 0;
+	size_t missCount = 0;
+
+public:
+	explicit texturePool(size_t maxIdlePerBucket = 4)
+		: maxIdlePerBucket{ maxIdlePerBucket }
+	{
+	}
+
+	~texturePool()
+	{
+		this->clear();
+	}
+
+	texturePool(const texturePool&) = delete;
+	texturePool& operator=(const texturePool&) = delete;
+
+	// An idle texture with storage for this shape, or 0 on a miss (the
+	// caller then allocates one and hands it to release() when done).
+	GLuint acquire(const bucketKey& key)
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		auto it = this->idle.find(key);
+		if (it == this->idle.end() || it->second.empty()) {
+			++(this->missCount);
+			return 0;
+		}
+		const GLuint id = it->second.back();
+		it->second.pop_back();
+		++(this->hitCount);
+		return id;
+	}
+
+	// Takes back a texture whose level 0 has this shape; deletes it when the
+	// bucket already holds maxIdlePerBucket textures.
+	void release(const bucketKey& key, GLuint id)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			auto& bucket = this->idle[key];
+			if (bucket.size() < this->maxIdlePerBucket) {
+				bucket.push_back(id);
+				return;
+			}
+		}
+		EGL_CHECK(glDeleteTextures(1, &id));
+	}
+
+	// Deletes every idle texture; textures still acquired are not affected.
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		for (auto& bucket : this->idle) {
+			if (!bucket.second.empty()) {
+				EGL_CHECK(glDeleteTextures(static_cast<GLsizei>(bucket.second.size()), bucket.second.data()));
+			}
+		}
+		this->idle.clear();
+	}
+
+	size_t idleCount()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		size_t count = 0;
+		for (const auto& bucket : this->idle)
+			count += bucket.second.size();
+		return count;
+	}
+
+	size_t hits()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		return this->hitCount;
+	}
+
+	size_t misses()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		return this->missCount;
+	}
+};
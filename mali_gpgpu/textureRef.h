@@ -0,0 +1,21 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+// Non-owning handle to a sampleable texture, from either a textureManager
+// upload or a texture-backed fboManager, so kernels can take both as inputs.
+struct textureRef
+{
+	GLuint id = 0;
+	GLsizei width = 0;
+	GLsizei height = 0;
+	GLenum target = GL_TEXTURE_2D;
+
+	// binds to textureUnit and points the sampler uniform of the program in use at it
+	inline void bindAsInput(GLenum textureUnit, GLint location) const
+	{
+		glActiveTexture(textureUnit);
+		glBindTexture(this->target, this->id);
+		glUniform1i(location, textureUnit - GL_TEXTURE0);
+	}
+};
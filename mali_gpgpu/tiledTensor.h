@@ -0,0 +1,308 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "macro.h"
+#include "computeQuad.h"
+#include "elementwise.h"
+#include "fboManager.h"
+#include "textureFormat.h"
+#include "textureManager.h"
+#include "textureRef.h"
+#include "traceRecorder.h"
+
+// 2D (or row-major 1D) array of RGBA texels of any size, split into tiles
+// that each fit one texture and render target: at most maxTileSize() =
+// min(GL_MAX_TEXTURE_SIZE, GL_MAX_RENDERBUFFER_SIZE, GL_MAX_VIEWPORT_DIMS)
+// per side. Kernels run once per tile (forEachTile(), run()).
+//
+// With halo > 0 every tile texture also holds `halo` texels of its
+// neighbours on each inner side, so a stencil or convolution of radius
+// <= halo reads only its own tile. Tiles on the tensor border get no outer
+// halo: GL_CLAMP_TO_EDGE then repeats the edge texel just as it would on
+// one big texture, so tiled and untiled results match. A kernel writing a
+// whole tile computes its halo from stale data; exchangeHalos() refreshes
+// it from the neighbours' cores before the next stencil pass.
+// Elementwise kernels need no exchange since halo texels map 1:1.
+class tiledTensor
+{
+public:
+	struct tile
+	{
+		// core: the tensor texels this tile owns
+		GLint x;
+		GLint y;
+		GLsizei width;
+		GLsizei height;
+		// tensor coordinates of texel (0, 0) of the tile texture, and its size
+		GLint originX;
+		GLint originY;
+		GLsizei textureWidth;
+		GLsizei textureHeight;
+
+		// core position inside the tile texture
+		inline GLint coreX() const { return this->x - this->originX; }
+		inline GLint coreY() const { return this->y - this->originY; }
+	};
+
+private:
+	const GLsizei tensorWidth;
+	const GLsizei tensorHeight;
+	const GLsizei halo;
+	const textureFormat& fmt;
+	GLsizei coreSize;
+	GLsizei tilesX;
+	GLsizei tilesY;
+	std::vector<tile> tiles;
+	std::vector<std::unique_ptr<textureManager>> textures;
+	std::vector<std::unique_ptr<fboManager>> targets;
+
+	static GLint queryInt(GLenum name)
+	{
+		GLint value[2] = { 0, 0 };
+		glGetIntegerv(name, value);
+		return value[0];
+	}
+
+	// host bytes per texel of download(): float32 RGBA for float formats
+	inline size_t downloadTexelBytes() const
+	{
+		return this->fmt.isFloat() ? 4 * sizeof(float) : static_cast<size_t>(this->fmt.bytesPerPixel);
+	}
+
+	// the intersection of a and b, false if empty
+	static bool intersect(GLint ax, GLint ay, GLsizei aw, GLsizei ah,
+		GLint bx, GLint by, GLsizei bw, GLsizei bh,
+		GLint& x, GLint& y, GLsizei& w, GLsizei& h)
+	{
+		x = std::max(ax, bx);
+		y = std::max(ay, by);
+		w = std::min(ax + aw, bx + bw) - x;
+		h = std::min(ay + ah, by + bh) - y;
+		return w > 0 && h > 0;
+	}
+
+public:
+	// tileLimit caps the tile texture size below maxTileSize(), 0: no cap
+	tiledTensor(GLsizei width, GLsizei height, GLsizei halo = 0,
+		const textureFormat& format = textureFormat::rgba8(), GLsizei tileLimit = 0)
+		: tensorWidth{ width }, tensorHeight{ height }, halo{ halo }, fmt(format)
+	{
+		if (format.channels != 4) {
+			fprintf(stderr, "tiledTensor: %s is not an RGBA format\n", format.name);
+			exit(-1);
+		}
+		const GLsizei limit = tileLimit > 0 ? std::min(tileLimit, maxTileSize()) : maxTileSize();
+		this->coreSize = limit - 2 * halo;
+		if (width <= 0 || height <= 0 || halo < 0 || this->coreSize < 1) {
+			fprintf(stderr, "tiledTensor: bad shape %dx%d, halo %d, tile limit %d\n", width, height, halo, limit);
+			exit(-1);
+		}
+		this->tilesX = (width + this->coreSize - 1) / this->coreSize;
+		this->tilesY = (height + this->coreSize - 1) / this->coreSize;
+
+		TRACE_SCOPE_NAMED(trace, "tiledTensor::allocate", "upload");
+		trace.arg("tiles", int64_t(this->tilesX) * this->tilesY);
+		for (GLsizei ty = 0; ty < this->tilesY; ++ty) {
+			for (GLsizei tx = 0; tx < this->tilesX; ++tx) {
+				tile t;
+				t.x = tx * this->coreSize;
+				t.y = ty * this->coreSize;
+				t.width = std::min(this->coreSize, width - t.x);
+				t.height = std::min(this->coreSize, height - t.y);
+				t.originX = std::max(0, t.x - halo);
+				t.originY = std::max(0, t.y - halo);
+				t.textureWidth = std::min(width, t.x + t.width + halo) - t.originX;
+				t.textureHeight = std::min(height, t.y + t.height + halo) - t.originY;
+				this->tiles.push_back(t);
+				this->textures.push_back(std::unique_ptr<textureManager>(new textureManager(
+					t.textureWidth, t.textureHeight, nullptr,
+					GL_TEXTURE0, -1, format)));
+				this->targets.push_back(std::unique_ptr<fboManager>(
+					new fboManager(this->textures.back()->ref(), format)));
+			}
+		}
+	}
+
+	tiledTensor(const tiledTensor&) = delete;
+	tiledTensor& operator=(const tiledTensor&) = delete;
+
+	// largest texture that can be sampled and rendered to; requires a current context
+	static GLsizei maxTileSize()
+	{
+		return std::min(std::min(queryInt(GL_MAX_TEXTURE_SIZE), queryInt(GL_MAX_RENDERBUFFER_SIZE)),
+			queryInt(GL_MAX_VIEWPORT_DIMS));
+	}
+
+	// 1D array of texels laid out row-major, rows as wide as a tile. No
+	// halo: the 2D one would hold the texels above and below instead of the
+	// previous and next row ends a 1D stencil needs.
+	static std::unique_ptr<tiledTensor> linear(size_t texels,
+		const textureFormat& format = textureFormat::rgba8(), GLsizei tileLimit = 0)
+	{
+		if (texels == 0) {
+			fprintf(stderr, "tiledTensor: bad shape, 0 texels\n");
+			exit(-1);
+		}
+		const GLsizei limit = tileLimit > 0 ? std::min(tileLimit, maxTileSize()) : maxTileSize();
+		const size_t rowLength = std::min(texels, static_cast<size_t>(limit));
+		const size_t rows = (texels + rowLength - 1) / rowLength;
+		return std::unique_ptr<tiledTensor>(new tiledTensor(static_cast<GLsizei>(rowLength),
+			static_cast<GLsizei>(rows), 0, format, tileLimit));
+	}
+
+	inline GLsizei width() const { return this->tensorWidth; }
+	inline GLsizei height() const { return this->tensorHeight; }
+	inline GLsizei haloSize() const { return this->halo; }
+	inline const textureFormat& format() const { return this->fmt; }
+	inline size_t tileCount() const { return this->tiles.size(); }
+	inline const tile& getTile(size_t index) const { return this->tiles[index]; }
+	inline textureRef ref(size_t index) const { return this->textures[index]->ref(); }
+	inline const fboManager& target(size_t index) const { return *(this->targets[index]); }
+
+	// same tile grid, so tile i of one covers tile i of the other
+	inline bool sameTiling(const tiledTensor& other) const
+	{
+		return this->tensorWidth == other.tensorWidth && this->tensorHeight == other.tensorHeight &&
+			this->halo == other.halo && this->coreSize == other.coreSize;
+	}
+
+	// fn(index, tile) for every tile; fn binds inputs and draws into target(index)
+	template <typename F>
+	void forEachTile(F fn) const
+	{
+		for (size_t i = 0; i < this->tiles.size(); ++i)
+			fn(i, this->tiles[i]);
+	}
+
+	// Uploads a row-major width-wide host image in the format's texel type,
+	// halos included. texelCount < width * height (a 1D array) zero-fills
+	// the rest; 0 means the whole tensor.
+	void upload(const void* pixels, size_t texelCount = 0)
+	{
+		const size_t total = static_cast<size_t>(this->tensorWidth) * this->tensorHeight;
+		if (texelCount == 0 || texelCount > total)
+			texelCount = total;
+		const size_t texelBytes = this->fmt.bytesPerPixel;
+		const GLubyte* source = static_cast<const GLubyte*>(pixels);
+		std::vector<GLubyte> staging;
+		TRACE_SCOPE("tiledTensor::upload", "upload");
+		for (size_t i = 0; i < this->tiles.size(); ++i) {
+			const tile& t = this->tiles[i];
+			const size_t lastTexel = static_cast<size_t>(t.originY + t.textureHeight - 1) * this->tensorWidth
+				+ t.originX + t.textureWidth;
+			const GLubyte* first = source + (static_cast<size_t>(t.originY) * this->tensorWidth + t.originX) * texelBytes;
+			if (lastTexel <= texelCount) {
+				// straight from the host image, strided
+				this->textures[i]->update(textureRect{ 0, 0, t.textureWidth, t.textureHeight }, first, this->tensorWidth);
+				continue;
+			}
+			const size_t rowBytes = t.textureWidth * texelBytes;
+			staging.assign(rowBytes * t.textureHeight, 0);
+			for (GLsizei row = 0; row < t.textureHeight; ++row) {
+				const size_t begin = static_cast<size_t>(t.originY + row) * this->tensorWidth + t.originX;
+				if (begin >= texelCount)
+					break;
+				const size_t count = std::min(static_cast<size_t>(t.textureWidth), texelCount - begin);
+				memcpy(&staging[row * rowBytes], source + begin * texelBytes, count * texelBytes);
+			}
+			this->textures[i]->update(staging.data());
+		}
+	}
+
+	// Reads the tile cores back into a row-major width-wide host image:
+	// bytes for rgba8, float32 RGBA for float formats (fboManager::readFloats).
+	// Stops after texelCount texels, 0 means the whole tensor.
+	void download(void* pixels, size_t texelCount = 0) const
+	{
+		const size_t total = static_cast<size_t>(this->tensorWidth) * this->tensorHeight;
+		if (texelCount == 0 || texelCount > total)
+			texelCount = total;
+		const size_t texelBytes = this->downloadTexelBytes();
+		GLubyte* destination = static_cast<GLubyte*>(pixels);
+		std::vector<GLubyte> staging;
+		TRACE_SCOPE("tiledTensor::download", "readback");
+		for (size_t i = 0; i < this->tiles.size(); ++i) {
+			const tile& t = this->tiles[i];
+			const size_t rowBytes = t.width * texelBytes;
+			staging.resize(rowBytes * t.height);
+			const fboManager& fbo = *(this->targets[i]);
+			fbo.bindFBO();
+			if (this->fmt.isFloat())
+				fbo.readFloats(t.coreX(), t.coreY(), t.width, t.height, reinterpret_cast<float*>(staging.data()));
+			else
+				fbo.readPixels(t.coreX(), t.coreY(), t.width, t.height, this->fmt.format, this->fmt.type, staging.data());
+			for (GLsizei row = 0; row < t.height; ++row) {
+				const size_t begin = static_cast<size_t>(t.y + row) * this->tensorWidth + t.x;
+				if (begin >= texelCount)
+					break;
+				const size_t count = std::min(static_cast<size_t>(t.width), texelCount - begin);
+				memcpy(destination + begin * texelBytes, &staging[row * rowBytes], count * texelBytes);
+			}
+		}
+	}
+
+	// Copies every halo from the cores of the neighbouring tiles, on the GPU
+	// (glCopyTexSubImage2D from the neighbour's framebuffer).
+	void exchangeHalos()
+	{
+		if (this->halo == 0)
+			return;
+		TRACE_SCOPE("tiledTensor::exchangeHalos", "dispatch");
+		// tiles within reach of a halo
+		const GLsizei reach = (this->halo + this->coreSize - 1) / this->coreSize;
+		for (GLsizei ty = 0; ty < this->tilesY; ++ty) {
+			for (GLsizei tx = 0; tx < this->tilesX; ++tx) {
+				const size_t i = static_cast<size_t>(ty) * this->tilesX + tx;
+				const tile& t = this->tiles[i];
+				for (GLsizei ny = std::max(0, ty - reach); ny <= std::min(this->tilesY - 1, ty + reach); ++ny) {
+					for (GLsizei nx = std::max(0, tx - reach); nx <= std::min(this->tilesX - 1, tx + reach); ++nx) {
+						const size_t n = static_cast<size_t>(ny) * this->tilesX + nx;
+						if (n == i)
+							continue;
+						const tile& src = this->tiles[n];
+						GLint x, y;
+						GLsizei w, h;
+						if (!intersect(t.originX, t.originY, t.textureWidth, t.textureHeight,
+							src.x, src.y, src.width, src.height, x, y, w, h))
+							continue;
+						this->targets[n]->bindFBO();
+						this->textures[i]->bind();
+						glCopyTexSubImage2D(GL_TEXTURE_2D, 0, x - t.originX, y - t.originY,
+							x - src.originX, y - src.originY, w, h);
+					}
+				}
+			}
+		}
+	}
+
+	// Elementwise kernel over whole tiles: output (this) tile i from input
+	// tiles i. Every tensor must share the tiling (sameTiling()).
+	void run(const elementwise::kernel& k, const computeQuad& quad,
+		std::initializer_list<const tiledTensor*> inputs)
+	{
+		for (const tiledTensor* input : inputs) {
+			if (!this->sameTiling(*input)) {
+				fprintf(stderr, "tiledTensor: input %dx%d tiled differently from output %dx%d\n",
+					input->width(), input->height(), this->tensorWidth, this->tensorHeight);
+				exit(-1);
+			}
+		}
+		std::vector<textureRef> refs(inputs.size());
+		this->forEachTile([&](size_t index, const tile&) {
+			size_t slot = 0;
+			for (const tiledTensor* input : inputs)
+				refs[slot++] = input->ref(index);
+			k.run(quad, this->target(index), refs);
+		});
+	}
+};
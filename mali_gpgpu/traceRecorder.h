@@ -0,0 +1,227 @@
+#pragma once
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "macro.h"
+
+// Opt-in host-side timeline in Chrome trace-event JSON (chrome://tracing,
+// ui.perfetto.dev). Every manager records complete ("X") events tagged with
+// the host thread and sizes/bytes moved. GL calls are asynchronous, so a draw
+// event shows submission cost; the GPU time surfaces in the readback waits.
+// Enable with MALI_GPGPU_TRACE=<file.json> or start(path); the file is
+// written by stop() or at process exit.
+class traceRecorder
+{
+public:
+	class scope
+	{
+		traceRecorder& recorder;
+		const char* name;
+		const char* category;
+		const bool active;
+		std::chrono::steady_clock::time_point start;
+		std::vector<std::pair<const char*, int64_t>> args;
+
+	public:
+		scope(const char* name, const char* category, traceRecorder& recorder = traceRecorder::instance())
+			: recorder{ recorder }, name{ name }, category{ category }, active{ recorder.isEnabled() }
+		{
+			if (this->active)
+				this->start = std::chrono::steady_clock::now();
+		}
+
+		~scope()
+		{
+			if (this->active)
+				this->recorder.complete(this->name, this->category, this->start,
+					std::chrono::steady_clock::now(), this->args);
+		}
+
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+
+		inline scope& arg(const char* key, int64_t value)
+		{
+			if (this->active)
+				this->args.emplace_back(key, value);
+			return *this;
+		}
+
+		inline bool isActive() const
+		{
+			return this->active;
+		}
+	};
+
+private:
+	std::mutex mtx;
+	std::atomic<bool> enabled{ false };
+	std::string path;
+	std::chrono::steady_clock::time_point origin;
+	std::ostringstream events;
+	bool firstEvent = true;
+	std::unordered_map<std::thread::id, int> threadIds;
+
+	traceRecorder()
+	{
+		// ts/dur in microseconds down to the ns; the default 6 significant
+		// digits turn into 10 us steps one second into a trace
+		this->events << std::fixed << std::setprecision(3);
+		const char* env = getenv("MALI_GPGPU_TRACE");
+		if (env != nullptr && *env != '\0')
+			this->start(env);
+	}
+
+	~traceRecorder()
+	{
+		this->stop();
+	}
+
+	static void writeEscaped(std::ostream& os, const char* str)
+	{
+		for (const char* p = str; *p != '\0'; ++p) {
+			if (*p == '"' || *p == '\\')
+				os << '\\' << *p;
+			else if (static_cast<unsigned char>(*p) >= 0x20)
+				os << *p;
+		}
+	}
+
+	// small stable ids read better in the viewer than hashed thread ids
+	int threadIdLocked()
+	{
+		const auto id = std::this_thread::get_id();
+		auto it = this->threadIds.find(id);
+		if (it != this->threadIds.end())
+			return it->second;
+		const int tid = static_cast<int>(this->threadIds.size()) + 1;
+		this->threadIds.emplace(id, tid);
+		this->separatorLocked();
+		this->events << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << tid
+			<< ",\"args\":{\"name\":\"" << (tid == 1 ? "host main" : "host worker ") ;
+		if (tid != 1)
+			this->events << tid - 1;
+		this->events << "\"}}";
+		return tid;
+	}
+
+	void separatorLocked()
+	{
+		if (!this->firstEvent)
+			this->events << ",\n";
+		this->firstEvent = false;
+	}
+
+public:
+	static traceRecorder& instance()
+	{
+		static traceRecorder recorder;
+		return recorder;
+	}
+
+	traceRecorder(const traceRecorder&) = delete;
+	traceRecorder& operator=(const traceRecorder&) = delete;
+
+	inline bool isEnabled() const
+	{
+		return this->enabled;
+	}
+
+	void start(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->path = path;
+		this->origin = std::chrono::steady_clock::now();
+		this->events.str("");
+		this->firstEvent = true;
+		this->threadIds.clear();
+		this->enabled = true;
+	}
+
+	// writes the collected events and disables tracing; false if the file failed
+	bool stop()
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		if (!this->enabled)
+			return true;
+		this->enabled = false;
+		std::ofstream file(this->path, std::ios::trunc);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+			<< this->events.str() << "\n]}\n";
+		this->events.str("");
+		return static_cast<bool>(file);
+	}
+
+	void complete(const char* name, const char* category,
+		std::chrono::steady_clock::time_point begin,
+		std::chrono::steady_clock::time_point end,
+		const std::vector<std::pair<const char*, int64_t>>& args)
+	{
+		using us = std::chrono::duration<double, std::micro>;
+		std::lock_guard<std::mutex> lock(this->mtx);
+		if (!this->enabled)
+			return;
+		const int tid = this->threadIdLocked();
+		this->separatorLocked();
+		this->events << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"name\":\"";
+		writeEscaped(this->events, name);
+		this->events << "\",\"cat\":\"";
+		writeEscaped(this->events, category);
+		this->events << "\",\"ts\":" << us(begin - this->origin).count()
+			<< ",\"dur\":" << us(end - begin).count();
+		if (!args.empty()) {
+			this->events << ",\"args\":{";
+			for (size_t i = 0; i < args.size(); ++i) {
+				this->events << (i ? "," : "") << "\"";
+				writeEscaped(this->events, args[i].first);
+				this->events << "\":" << args[i].second;
+			}
+			this->events << "}";
+		}
+		this->events << "}";
+	}
+
+	// bytes per pixel for glReadPixels/glTexImage2D format/type pairs
+	static GLsizei pixelSize(GLenum format, GLenum type)
+	{
+		GLsizei channels = 4;
+		switch (format) {
+		case GL_ALPHA: case GL_LUMINANCE: case GL_RED_EXT: channels = 1; break;
+		case GL_LUMINANCE_ALPHA: case GL_RG_EXT: channels = 2; break;
+		case GL_RGB: channels = 3; break;
+		default: break;
+		}
+		switch (type) {
+		case GL_UNSIGNED_SHORT_5_6_5:
+		case GL_UNSIGNED_SHORT_4_4_4_4:
+		case GL_UNSIGNED_SHORT_5_5_5_1: return 2;
+		case GL_HALF_FLOAT_OES:
+		case 0x140B: return channels * 2; // GL_HALF_FLOAT, ES3 drivers' read type
+		case GL_FLOAT: return channels * 4;
+		default: return channels;
+		}
+	}
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name, category) \
+	traceRecorder::scope TRACE_CONCAT(traceScope, __LINE__)(name, category)
+// named variant, for attaching args: TRACE_SCOPE_NAMED(t, ...); t.arg("bytes", n);
+#define TRACE_SCOPE_NAMED(var, name, category) \
+	traceRecorder::scope var(name, category)
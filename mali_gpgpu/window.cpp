@@ -1,3 +1,4 @@
+#ifdef _WIN32
 #include "window.h"
 
 HWND create_window(int uiWidth, int uiHeight) {
@@ -51,4 +52,5 @@ LRESULT CALLBACK process_window(HWND hWnd, UINT uiMsg, WPARAM wParam, LPARAM lPa
 	}
 
 	return DefWindowProc(hWnd, uiMsg, wParam, lParam);
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file